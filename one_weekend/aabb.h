@@ -0,0 +1,98 @@
+#ifndef AABB_H
+#define AABB_H
+
+#include "rtweekend.h"
+
+#include "packet.h"
+
+#include <limits>
+
+// Lane-wise slab test, returns the mask of lanes that hit the box. Kept out
+// of aabb, where min() and max() would name the box's own accessors.
+inline int slab_test(const point3& minimum, const point3& maximum, const ray_packet& r,
+                     real t_min, preal t_max, preal& t_entry) {
+    preal t0x = (preal(minimum.x()) - r.orig.x) * r.inv_dir.x;
+    preal t1x = (preal(maximum.x()) - r.orig.x) * r.inv_dir.x;
+    preal t0y = (preal(minimum.y()) - r.orig.y) * r.inv_dir.y;
+    preal t1y = (preal(maximum.y()) - r.orig.y) * r.inv_dir.y;
+    preal t0z = (preal(minimum.z()) - r.orig.z) * r.inv_dir.z;
+    preal t1z = (preal(maximum.z()) - r.orig.z) * r.inv_dir.z;
+
+    preal t_near = max(max(min(t0x, t1x), min(t0y, t1y)), max(min(t0z, t1z), preal(t_min)));
+    preal t_far  = min(min(max(t0x, t1x), max(t0y, t1y)), min(max(t0z, t1z), t_max));
+
+    t_entry = t_near;
+    return movemask(t_near <= t_far);
+}
+
+class aabb {
+    public:
+        // An empty box: surrounding it with any other box yields that box
+        aabb() : minimum(infinity, infinity, infinity), maximum(-infinity, -infinity, -infinity) {}
+        aabb(const point3& a, const point3& b) : minimum(a), maximum(b) {}
+
+        point3 min() const { return minimum; }
+        point3 max() const { return maximum; }
+
+        point3 centroid() const { return 0.5 * (minimum + maximum); }
+
+        real surface_area() const {
+            vec3 d = maximum - minimum;
+            if (d.x() < 0 || d.y() < 0 || d.z() < 0)
+                return 0;
+            return 2.0 * (d.x()*d.y() + d.y()*d.z() + d.z()*d.x());
+        }
+
+        int longest_axis() const {
+            vec3 d = maximum - minimum;
+            if (d.x() > d.y() && d.x() > d.z()) return 0;
+            return d.y() > d.z() ? 1 : 2;
+        }
+
+        // Slab test on all three axes at once. inv_dir is 1/r.direction(),
+        // computed once per ray by the caller. On a hit t_entry is the distance
+        // at which the ray enters the box.
+        inline bool hit(const ray& r, const vec3& inv_dir, real t_min, real t_max, real& t_entry) const {
+            vec3 t0 = (minimum - r.orig) * inv_dir;
+            vec3 t1 = (maximum - r.orig) * inv_dir;
+
+            real t_near = max_component(vmin(t0, t1));
+            real t_far = min_component(vmax(t0, t1));
+
+            t_entry = t_near > t_min ? t_near : t_min;
+            return t_entry <= (t_far < t_max ? t_far : t_max);
+        }
+
+        // Slab test of a ray packet, returns the mask of active lanes that hit
+        inline int hit(const ray_packet& r, real t_min, preal t_max, int active, preal& t_entry) const {
+            return slab_test(minimum, maximum, r, t_min, t_max, t_entry) & active;
+        }
+
+    public:
+        point3 minimum;
+        point3 maximum;
+};
+
+inline aabb surrounding_box(const aabb& box0, const aabb& box1) {
+    return aabb(vmin(box0.minimum, box1.minimum), vmax(box0.maximum, box1.maximum));
+}
+
+inline aabb surrounding_box(const aabb& box, const point3& p) {
+    return aabb(vmin(box.minimum, p), vmax(box.maximum, p));
+}
+
+// The box grown on every side so that flat shapes, such as axis-aligned
+// triangles, do not get a zero-width slab. The margin is relative to the
+// size of the box and to its distance from the origin, so that an asset
+// scaled up or down gets a box scaled the same way, and never smaller than
+// the rounding of its coordinates.
+inline aabb padded(const aabb& box) {
+    vec3 extent = box.maximum - box.minimum;
+    vec3 magnitude = vmax(vmax(box.minimum, -box.minimum), vmax(box.maximum, -box.maximum));
+    real margin = 1e-4 * max_component(extent)
+                + 4 * std::numeric_limits<real>::epsilon() * max_component(magnitude);
+    vec3 padding(margin, margin, margin);
+    return aabb(box.minimum - padding, box.maximum + padding);
+}
+
+#endif
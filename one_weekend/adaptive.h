@@ -0,0 +1,30 @@
+#ifndef ADAPTIVE_H
+#define ADAPTIVE_H
+
+#include "framebuffer.h"
+
+#include <algorithm>
+
+// Decides how many samples each pixel takes. Without a target error every
+// pixel takes max_samples in one round. With one, a pixel starts with
+// min_samples and takes min_samples more per round until the relative error
+// of its mean drops below the target or it reaches max_samples, so flat
+// regions stop early and the samples go to the noisy ones.
+struct sample_budget {
+    int min_samples;
+    int max_samples;
+    double target_error;    // 0: every pixel takes max_samples
+
+    // Number of samples the pixel takes in its next round, 0 once it is done
+    int next_round(const pixel_accumulator& pixel) const {
+        if (pixel.samples >= max_samples)
+            return 0;
+        if (target_error <= 0)
+            return max_samples - pixel.samples;
+        if (pixel.samples > 0 && pixel.relative_error() < target_error)
+            return 0;
+        return std::min(min_samples, max_samples - pixel.samples);
+    }
+};
+
+#endif
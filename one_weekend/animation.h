@@ -0,0 +1,58 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include "rtweekend.h"
+
+#include "instance.h"
+#include "scene.h"
+#include "transform.h"
+
+#include <vector>
+
+// Poses a built scene at any frame of a sequence. Only instances with a
+// motion and the camera change: the moving instances get new transforms and
+// the tree over the instances is refit, while every mesh and its tree stay
+// as they were built, so setting up a frame costs O(instances) at most.
+class scene_animation {
+    public:
+        scene_animation(const scene_desc& scene, scene_world& world)
+            : scene(scene), instances(world.instances.get())
+        {
+            if (instances) {
+                for (const motion_desc& m : scene.motions)
+                    start.push_back(instances->get(m.instance).to_world);
+            }
+        }
+
+        bool animated() const { return !start.empty() || scene.orbit != 0; }
+
+        // Moves everything to where it is at frame, and returns the camera
+        camera_settings set_frame(int frame) {
+            if (!start.empty()) {
+                for (size_t k = 0; k < start.size(); k++) {
+                    const motion_desc& m = scene.motions[k];
+                    const affine& first = start[k];
+                    affine to_world(first.row[0], first.row[1], first.row[2], vec3(0,0,0));
+                    if (m.degrees != 0)
+                        to_world = affine::rotation(m.axis, m.degrees * frame) * to_world;
+                    to_world.offset = first.offset + real(frame) * m.velocity;
+                    instances->set_transform(m.instance, to_world);
+                }
+                instances->refit();
+            }
+
+            camera_settings view = scene.camera;
+            if (scene.orbit != 0) {
+                affine turn = affine::rotation(view.vup, scene.orbit * frame);
+                view.lookfrom = view.lookat + turn.apply_vector(view.lookfrom - view.lookat);
+            }
+            return view;
+        }
+
+    private:
+        const scene_desc& scene;
+        instance_group* instances;
+        std::vector<affine> start;      // Transform at frame 0 of each motion's instance
+};
+
+#endif
@@ -0,0 +1,401 @@
+// Microbenchmarks of the vector math, intersection and scatter kernels.
+// Inputs come from fixed seeds, so runs on different commits time the same
+// work. Prints a table and, with --json PATH, writes the results as JSON.
+// --check runs the correctness checks of the intersection code instead.
+
+#include "rtweekend.h"
+
+#include "hittable_list.h"
+#include "sphere.h"
+#include "mesh.h"
+#include "material.h"
+#include "primitive_store.h"
+#include "triangle_mesh.h"
+#include "instance.h"
+#include "sampler.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Keeps the compiler from dropping a result nothing else reads
+template <typename T>
+inline void keep(const T& value) {
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+struct bench_result {
+    std::string name;
+    double ns_per_op;
+    bool rays;      // Operations are ray queries, also reported in Mrays/s
+};
+
+// Runs body(iterations), doubling the count until one run takes at least
+// min_seconds, then keeps the best of a few runs of that length.
+double time_per_op(const std::function<void(long)>& body) {
+    const double min_seconds = 0.05;
+    const int repeats = 5;
+    typedef std::chrono::steady_clock clock;
+
+    long iterations = 1;
+    for (;;) {
+        auto start = clock::now();
+        body(iterations);
+        double seconds = std::chrono::duration<double>(clock::now() - start).count();
+        if (seconds >= min_seconds)
+            break;
+        iterations *= 2;
+    }
+
+    double best = infinity;
+    for (int k = 0; k < repeats; k++) {
+        auto start = clock::now();
+        body(iterations);
+        double seconds = std::chrono::duration<double>(clock::now() - start).count();
+        best = fmin(best, seconds);
+    }
+    return best * 1e9 / iterations;
+}
+
+// Inputs are read round robin from arrays of this many entries, small enough
+// to stay in the L1 cache
+const int input_count = 1024;
+
+std::vector<vec3> random_vectors(uint64_t sequence) {
+    pcg32 rng(0x853c49e6748fea9bULL, sequence);
+    std::vector<vec3> v;
+    for (int k = 0; k < input_count; k++)
+        v.push_back(vec3::random(-1, 1, rng));
+    return v;
+}
+
+// Rays from a sphere of the given radius around the origin, aimed at random
+// points of the cube [-target, target]^3
+std::vector<ray> random_rays(real radius, real target, uint64_t sequence) {
+    pcg32 rng(0xda3e39cb94b95bdbULL, sequence);
+    std::vector<ray> rays;
+    for (int k = 0; k < input_count; k++) {
+        point3 origin = radius * random_unit_vector(rng);
+        point3 aim = vec3::random(-target, target, rng);
+        rays.push_back(ray(origin, aim - origin));
+    }
+    return rays;
+}
+
+template <typename Hittable>
+bench_result bench_hit(const std::string& name, const Hittable& object, const std::vector<ray>& rays) {
+    double ns = time_per_op([&](long iterations) {
+        int hits = 0;
+        for (long n = 0; n < iterations; n++) {
+            hit_record rec;
+            hits += object.hit(rays[n % input_count], 0.001, infinity, rec);
+        }
+        keep(hits);
+    });
+    return { name, ns, true };
+}
+
+// Same as bench_hit with the any-hit query of shadow rays, over the same
+// distance
+template <typename Hittable>
+bench_result bench_occluded(const std::string& name, const Hittable& object, const std::vector<ray>& rays) {
+    double ns = time_per_op([&](long iterations) {
+        int hits = 0;
+        for (long n = 0; n < iterations; n++)
+            hits += object.occluded(rays[n % input_count], 0.001, infinity);
+        keep(hits);
+    });
+    return { name, ns, true };
+}
+
+// Mesh of a sphere of the given radius about the origin, rings by twice as
+// many segments
+shared_ptr<triangle_mesh> sphere_mesh(int rings, real radius, const material* mat) {
+    std::vector<point3> vertices;
+    std::vector<int> indices;
+    int segments = 2 * rings;
+    for (int i = 0; i <= rings; i++) {
+        real theta = pi * i / rings;
+        for (int j = 0; j < segments; j++) {
+            real phi = 2 * pi * j / segments;
+            vertices.push_back(radius * vec3(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi)));
+        }
+    }
+    for (int i = 0; i < rings; i++) {
+        for (int j = 0; j < segments; j++) {
+            int a = i * segments + j, b = i * segments + (j + 1) % segments;
+            int c = a + segments, d = b + segments;
+            indices.insert(indices.end(), { a, b, c, b, d, c });
+        }
+    }
+    return make_shared<triangle_mesh>(std::move(vertices), std::move(indices), mat);
+}
+
+// Number of rays that hit the two objects differently: one and not the
+// other, or at distances more than a relative tolerance apart
+template <typename Hittable>
+int count_mismatches(const Hittable& a, const Hittable& b, const std::vector<ray>& rays) {
+    int mismatches = 0;
+    for (const ray& r : rays) {
+        hit_record rec_a, rec_b;
+        bool hit_a = a.hit(r, 0.001, infinity, rec_a);
+        bool hit_b = b.hit(r, 0.001, infinity, rec_b);
+        if (hit_a != hit_b || (hit_a && fabs(rec_a.t - rec_b.t) > 1e-3 * rec_a.t))
+            mismatches++;
+    }
+    return mismatches;
+}
+
+// One instance of a sphere mesh modelled with the given radius and scaled
+// to a unit sphere
+void instanced_sphere(instance_group& group, int rings, real radius, const material* mat) {
+    group.add_material(mat);
+    group.add(group.add_prototype(sphere_mesh(rings, radius, nullptr)), affine::scaling(vec3(1, 1, 1) / radius), 0);
+    group.build();
+}
+
+// The triangles of a mesh added to store as scene triangles of a light, as
+// a scene file lists them
+void tessellated_light(primitive_store& store, const triangle_mesh& mesh, const material* emissive) {
+    int light = store.add_material(emissive);
+    for (size_t k = 0; k + 2 < mesh.indices.size(); k += 3)
+        store.add_triangle(mesh.vertices[mesh.indices[k]], mesh.vertices[mesh.indices[k + 1]],
+                           mesh.vertices[mesh.indices[k + 2]], light);
+    store.build();
+}
+
+// Rays from eye to the centroid of every triangle of a closed, convex mesh
+// that faces eye, which they reach at t = 1
+std::vector<ray> centroid_rays(const triangle_mesh& mesh, const point3& eye) {
+    std::vector<ray> rays;
+    for (size_t k = 0; k + 2 < mesh.indices.size(); k += 3) {
+        point3 A = mesh.vertices[mesh.indices[k]];
+        point3 B = mesh.vertices[mesh.indices[k + 1]];
+        point3 C = mesh.vertices[mesh.indices[k + 2]];
+        point3 centroid = (A + B + C) / 3;
+        vec3 normal = cross(B - A, C - A);
+        if (normal.length_squared() > 0 && dot(normal, centroid) * dot(normal, centroid - eye) < 0)
+            rays.push_back(ray(eye, centroid - eye));
+    }
+    return rays;
+}
+
+// Checks the intersection code on the fixtures the benchmarks time: an
+// asset hits the same rays whatever its units, and scattered rays find
+// small emissive triangles wherever shadow rays sample them. Prints what
+// fails and returns false.
+bool check_geometry(const material* diffuse, const material* emissive) {
+    bool ok = true;
+    for (int rings : { 20, 200 }) {
+        instance_group metres, millimetres;
+        instanced_sphere(metres, rings, 1, diffuse);
+        instanced_sphere(millimetres, rings, 0.001, diffuse);
+        int mismatches = count_mismatches(metres, millimetres, random_rays(5, 1.4, 8));
+        if (mismatches) {
+            fprintf(stderr, "An asset in millimetres scaled by 1000 hits %d of %d rays unlike one in metres\n",
+                    mismatches, input_count);
+            ok = false;
+        }
+    }
+
+    shared_ptr<triangle_mesh> lamp = sphere_mesh(100, 0.3, nullptr);
+    primitive_store store;
+    tessellated_light(store, *lamp, emissive);
+    std::vector<ray> rays = centroid_rays(*lamp, point3(0, 1, 5));
+    int missed = 0;
+    for (const ray& r : rays) {
+        hit_record rec;
+        if (!store.hit(r, 0.001, infinity, rec) || fabs(rec.t - 1) > 1e-3)
+            missed++;
+    }
+    if (missed) {
+        fprintf(stderr, "Rays miss %d of %d small emissive triangles they are aimed at\n",
+                missed, static_cast<int>(rays.size()));
+        ok = false;
+    }
+    return ok;
+}
+
+// Scatters rays that hit a unit sphere off the material
+bench_result bench_scatter(const std::string& name, const material* mat) {
+    sphere ball(point3(0,0,0), 1, mat);
+    std::vector<ray> rays = random_rays(5, 0.7, 7);
+    std::vector<hit_record> records(input_count);
+    for (int k = 0; k < input_count; k++)
+        if (!ball.hit(rays[k], 0.001, infinity, records[k]))
+            ball.hit(ray(point3(0,0,5), vec3(0,0,-1)), 0.001, infinity, records[k]);
+
+    // The random sampler, so the one stream keeps giving new numbers
+    sample_stream samples(sampler_type::random, 1, 42, 7);
+    double ns = time_per_op([&](long iterations) {
+        for (long n = 0; n < iterations; n++) {
+            const hit_record& rec = records[n % input_count];
+            color attenuation;
+            ray scattered;
+            samples.start_bounce(0);
+            bool ok = rec.mat_ptr->scatter(rays[n % input_count], rec, attenuation, scattered, samples);
+            keep(ok);
+            keep(scattered);
+        }
+    });
+    return { name, ns, false };
+}
+
+bool write_json(const char* path, const std::vector<bench_result>& results) {
+    FILE* f = fopen(path, "w");
+    if (!f)
+        return false;
+    fprintf(f, "{\n  \"backend\": \"%s\",\n  \"precision\": \"%s\",\n  \"results\": [\n",
+            math_backend::name(), sizeof(real) == sizeof(double) ? "double" : "float");
+    for (size_t k = 0; k < results.size(); k++) {
+        const bench_result& r = results[k];
+        fprintf(f, "    {\"name\": \"%s\", \"ns_per_op\": %.3f", r.name.c_str(), r.ns_per_op);
+        if (r.rays)
+            fprintf(f, ", \"mrays_per_s\": %.3f", 1e3 / r.ns_per_op);
+        fprintf(f, "}%s\n", k + 1 < results.size() ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    return fclose(f) == 0;
+}
+
+int main(int argc, char* argv[]) {
+    const char* json_path = nullptr;
+    bool check = false;
+    for (int a = 1; a < argc; a++) {
+        if (!strcmp(argv[a], "--json") && a + 1 < argc) {
+            json_path = argv[++a];
+        } else if (!strcmp(argv[a], "--check")) {
+            check = true;
+        } else {
+            fprintf(stderr, "Usage: %s [--json PATH] [--check]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (check) {
+        material_table materials;
+        bool ok = check_geometry(materials.add<lambertian>(color(0.5, 0.5, 0.5)),
+                                 materials.add<diffuse_light>(color(4, 4, 4)));
+        return ok ? 0 : 1;
+    }
+
+    std::vector<bench_result> results;
+    std::vector<vec3> a = random_vectors(1), b = random_vectors(2), c = random_vectors(3);
+
+    // Vector math
+    results.push_back({ "vec3/dot", time_per_op([&](long iterations) {
+        real sum = 0;
+        for (long n = 0; n < iterations; n++)
+            sum += dot(a[n % input_count], b[n % input_count]);
+        keep(sum);
+    }), false });
+    results.push_back({ "vec3/cross", time_per_op([&](long iterations) {
+        for (long n = 0; n < iterations; n++)
+            keep(cross(a[n % input_count], b[n % input_count]));
+    }), false });
+    results.push_back({ "vec3/det", time_per_op([&](long iterations) {
+        real sum = 0;
+        for (long n = 0; n < iterations; n++)
+            sum += det(a[n % input_count], b[n % input_count], c[n % input_count]);
+        keep(sum);
+    }), false });
+    results.push_back({ "vec3/unit_vector", time_per_op([&](long iterations) {
+        for (long n = 0; n < iterations; n++)
+            keep(unit_vector(a[n % input_count]));
+    }), false });
+    results.push_back({ "vec3/random_in_unit_sphere", time_per_op([&](long iterations) {
+        pcg32 rng(42, 1);
+        for (long n = 0; n < iterations; n++)
+            keep(random_in_unit_sphere(rng));
+    }), false });
+
+    // Samplers: the camera and first bounce dimensions of one sample
+    for (sampler_type type : { sampler_type::random, sampler_type::stratified, sampler_type::halton, sampler_type::sobol }) {
+        sampler pixel_sampler = { type, 64 };
+        results.push_back({ std::string("sample_stream/") + sampler_type_name(type), time_per_op([&](long iterations) {
+            real sum = 0;
+            for (long n = 0; n < iterations; n++) {
+                sample_stream samples = pixel_sampler.start(n >> 6, n & 63);
+                for (int d = 0; d < 8; d++)
+                    sum += samples.next();
+            }
+            keep(sum);
+        }), false });
+    }
+
+    // Single primitives, hit by about half of the rays
+    material_table materials;
+    const material* diffuse = materials.add<lambertian>(color(0.5, 0.5, 0.5));
+
+    sphere ball(point3(0,0,0), 1, diffuse);
+    results.push_back(bench_hit("sphere::hit", ball, random_rays(5, 1.4, 4)));
+
+    mesh triangle(point3(-1,-1,0), point3(1,-1,0), point3(0,1,0), diffuse);
+    results.push_back(bench_hit("mesh::hit", triangle, random_rays(5, 1.4, 5)));
+
+    // Spheres scattered in a cube, in a plain list and behind the BVH
+    std::vector<ray> scene_rays = random_rays(40, 10, 6);
+    for (int size : { 1, 4, 16, 64, 256, 1024 }) {
+        pcg32 rng(0x5851f42d4c957f2dULL, size);
+        hittable_list list;
+        primitive_store store;
+        for (int k = 0; k < size; k++) {
+            auto s = make_shared<sphere>(vec3::random(-10, 10, rng), 0.5, diffuse);
+            list.add(s);
+            store.add(s);
+        }
+        store.build();
+
+        results.push_back(bench_hit("hittable_list::hit/" + std::to_string(size), list, scene_rays));
+        results.push_back(bench_hit("primitive_store::hit/" + std::to_string(size), store, scene_rays));
+        results.push_back(bench_occluded("primitive_store::occluded/" + std::to_string(size), store, scene_rays));
+    }
+
+    // A unit sphere mesh instanced as modelled in metres, and modelled in
+    // millimetres then scaled by 1000, which has to cost the same
+    for (int rings : { 20, 200 }) {
+        instance_group metres, millimetres;
+        instanced_sphere(metres, rings, 1, diffuse);
+        instanced_sphere(millimetres, rings, 0.001, diffuse);
+
+        std::vector<ray> rays = random_rays(5, 1.4, 8);
+        std::string triangles = std::to_string(4 * rings * rings);
+        results.push_back(bench_hit("instance_group::hit/m/" + triangles, metres, rays));
+        results.push_back(bench_hit("instance_group::hit/mm/" + triangles, millimetres, rays));
+    }
+
+    // A small light tessellated into scene triangles, hit by rays spread
+    // over the triangles that face them
+    {
+        shared_ptr<triangle_mesh> lamp = sphere_mesh(100, 0.3, nullptr);
+        primitive_store store;
+        tessellated_light(store, *lamp, materials.add<diffuse_light>(color(4, 4, 4)));
+
+        std::vector<ray> aimed = centroid_rays(*lamp, point3(0, 1, 5)), rays;
+        for (int k = 0; k < input_count; k++)
+            rays.push_back(aimed[k * aimed.size() / input_count]);
+        results.push_back(bench_hit("primitive_store::hit/light/" + std::to_string(lamp->size()), store, rays));
+    }
+
+    // Materials
+    results.push_back(bench_scatter("lambertian::scatter", diffuse));
+    results.push_back(bench_scatter("metal::scatter", materials.add<metal>(color(0.7, 0.6, 0.5), 0.3)));
+    results.push_back(bench_scatter("dielectric::scatter", materials.add<dielectric>(1.5)));
+
+    printf("Math backend: %s\n", math_backend::name());
+    printf("%-32s %12s %12s\n", "benchmark", "ns/op", "Mrays/s");
+    for (const bench_result& r : results) {
+        if (r.rays)
+            printf("%-32s %12.2f %12.2f\n", r.name.c_str(), r.ns_per_op, 1e3 / r.ns_per_op);
+        else
+            printf("%-32s %12.2f %12s\n", r.name.c_str(), r.ns_per_op, "");
+    }
+
+    if (json_path && !write_json(json_path, results)) {
+        fprintf(stderr, "Cannot write %s: %s\n", json_path, strerror(errno));
+        return 1;
+    }
+}
@@ -0,0 +1,474 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "rtweekend.h"
+
+#include "aabb.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "flat_array.h"
+
+#include <algorithm>
+#include <vector>
+
+// Node of a flattened bounding volume hierarchy. An interior node is followed
+// by its left child and stores the index of its right child; a leaf stores a
+// contiguous range of primitives.
+struct bvh_flat_node {
+    aabb box;
+    int offset;     // Right child if interior, first primitive if leaf
+    int count;      // Number of primitives, 0 for interior nodes
+
+    bool is_leaf() const { return count > 0; }
+};
+
+class bvh_tree {
+    public:
+        bvh_tree() {}
+
+        // Builds the hierarchy over the primitive boxes using a binned surface
+        // area heuristic. Returns the order in which the caller has to store its
+        // primitives so that each leaf references a contiguous range of them.
+        std::vector<int> build(const std::vector<aabb>& boxes, int max_leaf_size);
+
+        // Recomputes the boxes bottom up after primitives moved, keeping the
+        // hierarchy, in O(n). primitive_box(i) is the new box of the primitive
+        // stored at i. Trees get slower to traverse the further things move
+        // from where they were built.
+        template <typename PrimitiveBox>
+        void refit(PrimitiveBox&& primitive_box);
+
+        aabb bounding_box() const { return nodes.empty() ? aabb() : nodes[0].box; }
+
+        // Whether the nodes form a tree the traversals can walk safely over
+        // primitive_count primitives, as build() makes them: each child after
+        // its parent and within the nodes, each leaf within the primitives
+        // and no path deeper than the traversal stacks. For trees that were
+        // read from a file.
+        bool valid(int primitive_count) const;
+
+        // Closest-hit traversal, front to back. leaf_hit(first, count, closest)
+        // tests a range of primitives, shrinks closest and returns true on a hit.
+        template <typename LeafHit>
+        bool traverse(const ray& r, real t_min, real t_max, LeafHit&& leaf_hit) const;
+
+        // Any-hit traversal for occlusion queries, in no particular order.
+        // leaf_hit(first, count) tests a range of primitives; the traversal
+        // stops at the first one that returns true.
+        template <typename LeafHit>
+        bool traverse_any(const ray& r, real t_min, real t_max, LeafHit&& leaf_hit) const;
+
+        // Packet traversal. A subtree is entered when any active lane hits its
+        // box, and only with those lanes. leaf_hit(first, count, active) tests a
+        // range of primitives and returns the mask of lanes that hit.
+        template <typename LeafHit>
+        int traverse_packet(const ray_packet& r, real t_min, preal& t_max, int active, LeafHit&& leaf_hit) const;
+
+    public:
+        flat_array<bvh_flat_node> nodes;
+
+    private:
+        struct build_primitive {
+            aabb box;
+            point3 centroid;
+            int index;
+        };
+
+        static const int sah_bins = 16;
+        static const int max_sah_depth = 64;
+        static const int stack_size = 128;
+
+        static void build_recursive(std::vector<bvh_flat_node>& built, std::vector<build_primitive>& prims,
+                                    int begin, int end, int depth, int max_leaf_size);
+};
+
+std::vector<int> bvh_tree::build(const std::vector<aabb>& boxes, int max_leaf_size) {
+    std::vector<build_primitive> prims(boxes.size());
+    for (size_t i = 0; i < boxes.size(); i++)
+        prims[i] = { boxes[i], boxes[i].centroid(), static_cast<int>(i) };
+
+    std::vector<bvh_flat_node> built;
+    if (!prims.empty()) {
+        built.reserve(2 * prims.size());
+        build_recursive(built, prims, 0, static_cast<int>(prims.size()), 0, max_leaf_size);
+    }
+    nodes.assign(std::move(built));
+
+    std::vector<int> order(prims.size());
+    for (size_t i = 0; i < prims.size(); i++)
+        order[i] = prims[i].index;
+    return order;
+}
+
+void bvh_tree::build_recursive(std::vector<bvh_flat_node>& built, std::vector<build_primitive>& prims,
+                               int begin, int end, int depth, int max_leaf_size) {
+    int node_index = static_cast<int>(built.size());
+    built.push_back({});
+
+    aabb box, centroid_box;
+    for (int i = begin; i < end; i++) {
+        box = surrounding_box(box, prims[i].box);
+        centroid_box = surrounding_box(centroid_box, prims[i].centroid);
+    }
+    built[node_index].box = box;
+
+    int count = end - begin;
+    if (count == 1) {
+        built[node_index].offset = begin;
+        built[node_index].count = count;
+        return;
+    }
+
+    // Binned SAH: try sah_bins-1 candidate planes per axis, the cost of a split
+    // is the expected number of primitive tests relative to this node's area
+    int best_axis = -1;
+    int best_split = 0;
+    real best_cost = infinity;
+
+    for (int axis = 0; axis < 3 && depth < max_sah_depth; axis++) {
+        real c_min = centroid_box.minimum[axis];
+        real extent = centroid_box.maximum[axis] - c_min;
+        if (extent <= 0)
+            continue;
+
+        int bin_count[sah_bins] = {};
+        aabb bin_box[sah_bins];
+        real scale = sah_bins / extent;
+
+        for (int i = begin; i < end; i++) {
+            int b = std::min(sah_bins - 1, static_cast<int>((prims[i].centroid[axis] - c_min) * scale));
+            bin_count[b]++;
+            bin_box[b] = surrounding_box(bin_box[b], prims[i].box);
+        }
+
+        // Sweep from the right to get the cost of everything past each plane
+        real right_cost[sah_bins];
+        aabb right_box;
+        int right_count = 0;
+        for (int b = sah_bins - 1; b > 0; b--) {
+            right_box = surrounding_box(right_box, bin_box[b]);
+            right_count += bin_count[b];
+            right_cost[b] = right_count * right_box.surface_area();
+        }
+
+        aabb left_box;
+        int left_count = 0;
+        for (int b = 0; b < sah_bins - 1; b++) {
+            left_box = surrounding_box(left_box, bin_box[b]);
+            left_count += bin_count[b];
+            real cost = left_count * left_box.surface_area() + right_cost[b+1];
+            if (left_count > 0 && left_count < count && cost < best_cost) {
+                best_cost = cost;
+                best_axis = axis;
+                best_split = b + 1;
+            }
+        }
+    }
+
+    real area = box.surface_area();
+    real split_cost = area > 0 ? 1.0 + best_cost / area : infinity;
+    if (count <= max_leaf_size && split_cost >= count) {
+        built[node_index].offset = begin;
+        built[node_index].count = count;
+        return;
+    }
+
+    int mid;
+    if (best_axis >= 0) {
+        real c_min = centroid_box.minimum[best_axis];
+        real scale = sah_bins / (centroid_box.maximum[best_axis] - c_min);
+        auto first = prims.begin() + begin;
+        mid = begin + static_cast<int>(std::partition(first, prims.begin() + end,
+            [=](const build_primitive& p) {
+                int b = std::min(sah_bins - 1, static_cast<int>((p.centroid[best_axis] - c_min) * scale));
+                return b < best_split;
+            }) - first);
+    } else {
+        // Coincident centroids or a degenerate tree: fall back to a median split
+        int axis = centroid_box.longest_axis();
+        mid = (begin + end) / 2;
+        std::nth_element(prims.begin() + begin, prims.begin() + mid, prims.begin() + end,
+            [=](const build_primitive& a, const build_primitive& b) {
+                return a.centroid[axis] < b.centroid[axis];
+            });
+    }
+
+    built[node_index].count = 0;
+    build_recursive(built, prims, begin, mid, depth + 1, max_leaf_size);
+    built[node_index].offset = static_cast<int>(built.size());
+    build_recursive(built, prims, mid, end, depth + 1, max_leaf_size);
+}
+
+bool bvh_tree::valid(int primitive_count) const {
+    if (nodes.size() > size_t(std::numeric_limits<int>::max()))
+        return false;
+
+    // Subtrees still to check, each the nodes [first, end) rooted at first
+    struct subtree { int first; int end; int depth; };
+    std::vector<subtree> pending;
+    if (!nodes.empty())
+        pending.push_back({ 0, static_cast<int>(nodes.size()), 0 });
+
+    while (!pending.empty()) {
+        subtree s = pending.back();
+        pending.pop_back();
+        const bvh_flat_node& n = nodes[s.first];
+        if (n.is_leaf()) {
+            if (s.end != s.first + 1 || n.offset < 0 || n.offset > primitive_count - n.count)
+                return false;
+        } else {
+            int right = n.offset;
+            if (n.count != 0 || s.depth >= stack_size || right <= s.first + 1 || right >= s.end)
+                return false;
+            pending.push_back({ s.first + 1, right, s.depth + 1 });
+            pending.push_back({ right, s.end, s.depth + 1 });
+        }
+    }
+    return true;
+}
+
+template <typename PrimitiveBox>
+void bvh_tree::refit(PrimitiveBox&& primitive_box) {
+    // Children always come after their parent
+    bvh_flat_node* node = nodes.mutable_data();
+    for (int n = static_cast<int>(nodes.size()) - 1; n >= 0; n--) {
+        aabb box;
+        if (node[n].is_leaf()) {
+            for (int i = node[n].offset; i < node[n].offset + node[n].count; i++)
+                box = surrounding_box(box, primitive_box(i));
+        } else {
+            box = surrounding_box(node[n+1].box, node[node[n].offset].box);
+        }
+        node[n].box = box;
+    }
+}
+
+template <typename LeafHit>
+bool bvh_tree::traverse(const ray& r, real t_min, real t_max, LeafHit&& leaf_hit) const {
+    if (nodes.empty())
+        return false;
+
+    vec3 d = r.direction();
+    vec3 inv_dir(1.0 / d.x(), 1.0 / d.y(), 1.0 / d.z());
+
+    real t_entry;
+    if (!nodes[0].box.hit(r, inv_dir, t_min, t_max, t_entry))
+        return false;
+
+    struct stack_entry { int node; real t_entry; };
+    stack_entry stack[stack_size];
+    int stack_ptr = 0;
+
+    bool hit_anything = false;
+    real closest_so_far = t_max;
+    int node = 0;
+
+    while (true) {
+        const bvh_flat_node& n = nodes[node];
+
+        if (n.is_leaf()) {
+            if (leaf_hit(n.offset, n.count, closest_so_far))
+                hit_anything = true;
+        } else {
+            int left = node + 1;
+            int right = n.offset;
+            real t_left, t_right;
+            bool hit_left = nodes[left].box.hit(r, inv_dir, t_min, closest_so_far, t_left);
+            bool hit_right = nodes[right].box.hit(r, inv_dir, t_min, closest_so_far, t_right);
+
+            if (hit_left && hit_right) {
+                // Visit the nearer child first, the other one may get culled later
+                if (t_right < t_left) {
+                    std::swap(left, right);
+                    std::swap(t_left, t_right);
+                }
+                stack[stack_ptr++] = { right, t_right };
+                node = left;
+                continue;
+            }
+            if (hit_left)  { node = left;  continue; }
+            if (hit_right) { node = right; continue; }
+        }
+
+        // Pop the next subtree that can still contain a closer hit
+        do {
+            if (stack_ptr == 0)
+                return hit_anything;
+            stack_ptr--;
+        } while (stack[stack_ptr].t_entry > closest_so_far);
+        node = stack[stack_ptr].node;
+    }
+}
+
+template <typename LeafHit>
+bool bvh_tree::traverse_any(const ray& r, real t_min, real t_max, LeafHit&& leaf_hit) const {
+    if (nodes.empty())
+        return false;
+
+    vec3 d = r.direction();
+    vec3 inv_dir(1.0 / d.x(), 1.0 / d.y(), 1.0 / d.z());
+
+    real t_entry;
+    if (!nodes[0].box.hit(r, inv_dir, t_min, t_max, t_entry))
+        return false;
+
+    int stack[stack_size];
+    int stack_ptr = 0;
+    int node = 0;
+
+    while (true) {
+        const bvh_flat_node& n = nodes[node];
+
+        if (n.is_leaf()) {
+            if (leaf_hit(n.offset, n.count))
+                return true;
+        } else {
+            int left = node + 1;
+            int right = n.offset;
+            real t_left, t_right;
+            bool hit_left = nodes[left].box.hit(r, inv_dir, t_min, t_max, t_left);
+            bool hit_right = nodes[right].box.hit(r, inv_dir, t_min, t_max, t_right);
+
+            if (hit_left && hit_right) {
+                stack[stack_ptr++] = right;
+                node = left;
+                continue;
+            }
+            if (hit_left)  { node = left;  continue; }
+            if (hit_right) { node = right; continue; }
+        }
+
+        if (stack_ptr == 0)
+            return false;
+        node = stack[--stack_ptr];
+    }
+}
+
+template <typename LeafHit>
+int bvh_tree::traverse_packet(const ray_packet& r, real t_min, preal& t_max, int active, LeafHit&& leaf_hit) const {
+    if (nodes.empty() || !active)
+        return 0;
+
+    preal t_entry;
+    int mask = nodes[0].box.hit(r, t_min, t_max, active, t_entry);
+    if (!mask)
+        return 0;
+
+    struct stack_entry { int node; int mask; };
+    stack_entry stack[stack_size];
+    int stack_ptr = 0;
+
+    int hits = 0;
+    int node = 0;
+
+    while (true) {
+        const bvh_flat_node& n = nodes[node];
+
+        if (n.is_leaf()) {
+            hits |= leaf_hit(n.offset, n.count, mask);
+        } else {
+            int left = node + 1;
+            int right = n.offset;
+            preal t_left, t_right;
+            int mask_left = nodes[left].box.hit(r, t_min, t_max, mask, t_left);
+            int mask_right = nodes[right].box.hit(r, t_min, t_max, mask, t_right);
+
+            if (mask_left && mask_right) {
+                // Visit first the child that is nearer for most of the lanes
+                int both = mask_left & mask_right;
+                int right_nearer = movemask(t_right < t_left) & both;
+                if (2 * __builtin_popcount(right_nearer) > __builtin_popcount(both)) {
+                    std::swap(left, right);
+                    std::swap(mask_left, mask_right);
+                }
+                stack[stack_ptr++] = { right, mask_right };
+                node = left;
+                mask = mask_left;
+                continue;
+            }
+            if (mask_left)  { node = left;  mask = mask_left;  continue; }
+            if (mask_right) { node = right; mask = mask_right; continue; }
+        }
+
+        // Pop the next subtree, retesting its box against the narrowed t_max
+        do {
+            if (stack_ptr == 0)
+                return hits;
+            stack_ptr--;
+            mask = nodes[stack[stack_ptr].node].box.hit(r, t_min, t_max, stack[stack_ptr].mask, t_entry);
+        } while (!mask);
+        node = stack[stack_ptr].node;
+    }
+}
+
+class bvh_node : public hittable {
+    public:
+        bvh_node() {}
+        bvh_node(const hittable_list& list) : bvh_node(list.objects) {}
+        bvh_node(const std::vector<shared_ptr<hittable>>& src_objects);
+
+        virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec)
+            const override;
+
+        virtual bool bounding_box(aabb& output_box) const override;
+
+        virtual bool occluded(const ray& r, real t_min, real t_max) const override;
+
+        virtual int hit_packet(const ray_packet& r, real t_min, preal& t_max, hit_record* rec, int active)
+            const override;
+
+    public:
+        std::vector<shared_ptr<hittable>> objects;
+        bvh_tree tree;
+};
+
+bvh_node::bvh_node(const std::vector<shared_ptr<hittable>>& src_objects) {
+    std::vector<aabb> boxes(src_objects.size());
+    for (size_t i = 0; i < src_objects.size(); i++)
+        src_objects[i]->bounding_box(boxes[i]);
+
+    // Objects are tested through a virtual call, keep leaves small
+    std::vector<int> order = tree.build(boxes, 2);
+
+    objects.reserve(order.size());
+    for (int i : order)
+        objects.push_back(src_objects[i]);
+}
+
+bool bvh_node::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+    return tree.traverse(r, t_min, t_max, [&](int first, int count, real& closest_so_far) {
+        bool hit_anything = false;
+        for (int i = first; i < first + count; i++) {
+            if (objects[i]->hit(r, t_min, closest_so_far, rec)) {
+                hit_anything = true;
+                closest_so_far = rec.t;
+            }
+        }
+        return hit_anything;
+    });
+}
+
+bool bvh_node::occluded(const ray& r, real t_min, real t_max) const {
+    return tree.traverse_any(r, t_min, t_max, [&](int first, int count) {
+        for (int i = first; i < first + count; i++)
+            if (objects[i]->occluded(r, t_min, t_max))
+                return true;
+        return false;
+    });
+}
+
+int bvh_node::hit_packet(const ray_packet& r, real t_min, preal& t_max, hit_record* rec, int active) const {
+    return tree.traverse_packet(r, t_min, t_max, active, [&](int first, int count, int mask) {
+        int hits = 0;
+        for (int i = first; i < first + count; i++)
+            hits |= objects[i]->hit_packet(r, t_min, t_max, rec, mask);
+        return hits;
+    });
+}
+
+bool bvh_node::bounding_box(aabb& output_box) const {
+    output_box = tree.bounding_box();
+    return !tree.nodes.empty();
+}
+
+#endif
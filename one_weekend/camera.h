@@ -2,6 +2,7 @@
 #define CAMERA_H
 
 #include "rtweekend.h"
+#include "sampler.h"
 
 class camera {
     public:
@@ -9,19 +10,19 @@ class camera {
             point3 lookfrom,
             point3 lookat,
             vec3 vup,
-            double vfov, 
-            double aspect_ratio,
-            double aperture,
-            double focal_length
+            real vfov, 
+            real aspect_ratio,
+            real aperture,
+            real focal_length
         ) {
-            double theta = degrees_to_radians(vfov);
-            double h = tan(0.5 * theta);
-            double viewport_height = 2.0 * h;
-            double viewport_width = aspect_ratio * viewport_height;
+            real theta = degrees_to_radians(vfov);
+            real h = tan(0.5 * theta);
+            real viewport_height = 2.0 * h;
+            real viewport_width = aspect_ratio * viewport_height;
 
             w = unit_vector(lookfrom - lookat);
             u = unit_vector(cross(vup, w));
-            v = cross(w,u);
+            v = unit_vector(cross(w,u));
 
             origin = lookfrom;
             horizontal = focal_length * viewport_width * u;
@@ -31,8 +32,12 @@ class camera {
             lens_radius = aperture / 2;
         }
 
-        ray get_ray(double s, double t) const {
-            vec3 rd = lens_radius * random_in_unit_disk();
+        // Ray through (s, t) of the viewport, from a point of the lens picked
+        // by the lens dimensions of the sample
+        ray get_ray(real s, real t, sample_stream& samples) const {
+            real lens_u = samples.next();
+            real lens_v = samples.next();
+            vec3 rd = lens_radius * square_to_disk(lens_u, lens_v);
             vec3 offset = u * rd.x() + v * rd.y();
 
             return ray(
@@ -47,7 +52,7 @@ class camera {
         vec3 horizontal;
         vec3 vertical;
         vec3 u, v, w;
-        double lens_radius;
+        real lens_radius;
 };
 
 #endif
\ No newline at end of file
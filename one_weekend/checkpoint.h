@@ -0,0 +1,146 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "rtweekend.h"
+
+#include "framebuffer.h"
+#include "image_writer.h"
+#include "sampler.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+// A checkpoint is this header followed by one record per pixel, rows from
+// the top of the image down, in native byte order. The generators are
+// derived from (pixel, sample index), so the sample count of a pixel is all
+// the random state a resumed render needs to go on where it stopped, as
+// long as it renders the same scene with the same sampler and strata.
+struct checkpoint_header {
+    char magic[8];          // "RTWCKPT"
+    uint32_t version;
+    uint32_t real_size;     // Bytes per component of the sums
+    uint64_t scene_key;     // geometry_cache_key of the scene rendered
+    int32_t width;
+    int32_t height;
+    int32_t sampler;        // sampler_type of the samples summed
+    int32_t strata;         // sampler::strata, kept by the render that resumes
+};
+
+struct checkpoint_record {
+    real sum[3];
+    real luminance_sq;
+    int32_t samples;
+};
+
+const char checkpoint_magic[8] = "RTWCKPT";
+const uint32_t checkpoint_version = 3;
+
+inline bool read_all(int fd, void* data, size_t size) {
+    char* p = static_cast<char*>(data);
+    while (size > 0) {
+        ssize_t n = ::read(fd, p, size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (n == 0) {
+            errno = EINVAL;     // Truncated file
+            return false;
+        }
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+// Writes the accumulated sums and sample counts of every pixel to path,
+// along with the scene and sampler they were rendered with. The file is
+// written under a temporary name and renamed into place, so a job killed
+// halfway leaves the previous checkpoint intact.
+bool save_checkpoint(const char* path, const framebuffer& image, uint64_t scene_key, const sampler& pixel_sampler) {
+    std::string temporary = std::string(path) + ".tmp";
+    int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+
+    checkpoint_header header = {};
+    std::memcpy(header.magic, checkpoint_magic, sizeof(header.magic));
+    header.version = checkpoint_version;
+    header.real_size = sizeof(real);
+    header.scene_key = scene_key;
+    header.width = image.width;
+    header.height = image.height;
+    header.sampler = static_cast<int32_t>(pixel_sampler.type);
+    header.strata = pixel_sampler.strata;
+    bool ok = write_all(fd, &header, sizeof(header));
+
+    std::vector<checkpoint_record> band(size_t(image.tile_size) * image.width);
+    for (int band_start = 0; ok && band_start < image.height; band_start += image.tile_size) {
+        int rows = std::min(image.tile_size, image.height - band_start);
+        checkpoint_record* out = band.data();
+        for (int row = band_start; row < band_start + rows; row++) {
+            int j = image.height - 1 - row;
+            for (int i = 0; i < image.width; i++, out++) {
+                const pixel_accumulator& pixel = image.at(i, j);
+                out->sum[0] = pixel.sum.x();
+                out->sum[1] = pixel.sum.y();
+                out->sum[2] = pixel.sum.z();
+                out->luminance_sq = pixel.luminance_sq;
+                out->samples = pixel.samples;
+            }
+        }
+        ok = write_all(fd, band.data(), rows * image.width * sizeof(checkpoint_record));
+    }
+
+    ok = close(fd) == 0 && ok;
+    return ok && rename(temporary.c_str(), path) == 0;
+}
+
+// Fills image from a checkpoint written by save_checkpoint, and sets the
+// strata of pixel_sampler to those of the samples already taken, so that
+// the blocks of the stratified sampler line up. Fails with EINVAL when the
+// file is not a checkpoint of the same scene, rendered with the same type
+// of sampler to an image of the same size, whose sums it would corrupt.
+bool load_checkpoint(const char* path, framebuffer& image, uint64_t scene_key, sampler& pixel_sampler) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    checkpoint_header header;
+    bool ok = read_all(fd, &header, sizeof(header));
+    if (ok && (std::memcmp(header.magic, checkpoint_magic, sizeof(header.magic)) != 0
+               || header.version != checkpoint_version || header.real_size != sizeof(real)
+               || header.scene_key != scene_key || header.sampler != static_cast<int32_t>(pixel_sampler.type)
+               || header.strata <= 0 || header.width != image.width || header.height != image.height)) {
+        errno = EINVAL;
+        ok = false;
+    }
+    if (ok)
+        pixel_sampler.strata = header.strata;
+
+    std::vector<checkpoint_record> band(size_t(image.tile_size) * image.width);
+    for (int band_start = 0; ok && band_start < image.height; band_start += image.tile_size) {
+        int rows = std::min(image.tile_size, image.height - band_start);
+        ok = read_all(fd, band.data(), rows * image.width * sizeof(checkpoint_record));
+        const checkpoint_record* in = band.data();
+        for (int row = band_start; ok && row < band_start + rows; row++) {
+            int j = image.height - 1 - row;
+            for (int i = 0; i < image.width; i++, in++) {
+                pixel_accumulator& pixel = image.at(i, j);
+                pixel.sum = color(in->sum[0], in->sum[1], in->sum[2]);
+                pixel.luminance_sq = in->luminance_sq;
+                pixel.samples = in->samples;
+            }
+        }
+    }
+
+    close(fd);
+    return ok;
+}
+
+#endif
@@ -2,24 +2,60 @@
 #define COLOR_H
 
 #include "vec3.h"
+#include "isa.h"
 
-#include <iostream>
+#include <cstddef>
+#include <immintrin.h>
 
-void write_color(std::ostream &out, color pixel_color, int samples_per_pixel) {
-    double r = pixel_color.x();
-    double g = pixel_color.y();
-    double b = pixel_color.z();
+// Relative luminance of a linear Rec. 709 color
+inline float luminance(const color& c) {
+    return dot(c, color(0.2126, 0.7152, 0.0722));
+}
+
+// Converts count linear values, already divided by the number of samples,
+// to gamma-2 encoded bytes, 32 at a time with AVX2 and 16 with SSE4.1.
+void encode_gamma2(const float* linear, unsigned char* out, size_t count) {
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(0.999f);
+    const __m128 scale = _mm_set1_ps(256.0f);
+
+    size_t k = 0;
+#ifdef SIMD_AVX2
+    const __m256 zero8 = _mm256_setzero_ps();
+    const __m256 one8 = _mm256_set1_ps(0.999f);
+    const __m256 scale8 = _mm256_set1_ps(256.0f);
+    // The packs work within 128-bit halves; this puts the groups of four
+    // bytes back in order
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
 
-    // Divide the color by the number of samples
-    double scale = 1.0 / samples_per_pixel;
-    r = sqrt(r * scale);
-    g = sqrt(g * scale);
-    b = sqrt(b * scale);
+    for (; k + 32 <= count; k += 32) {
+        __m256i q[4];
+        for (int v = 0; v < 4; v++) {
+            __m256 x = _mm256_loadu_ps(linear + k + 8*v);
+            x = _mm256_min_ps(_mm256_sqrt_ps(_mm256_max_ps(x, zero8)), one8);
+            q[v] = _mm256_cvttps_epi32(_mm256_mul_ps(x, scale8));
+        }
+        __m256i bytes = _mm256_packus_epi16(_mm256_packs_epi32(q[0], q[1]), _mm256_packs_epi32(q[2], q[3]));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + k), _mm256_permutevar8x32_epi32(bytes, order));
+    }
+#endif
+    for (; k + 16 <= count; k += 16) {
+        __m128i q[4];
+        for (int v = 0; v < 4; v++) {
+            __m128 x = _mm_loadu_ps(linear + k + 4*v);
+            x = _mm_min_ps(_mm_sqrt_ps(_mm_max_ps(x, zero)), one);
+            // Write the translated [0,255] value of each color component.
+            q[v] = _mm_cvttps_epi32(_mm_mul_ps(x, scale));
+        }
+        __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(q[0], q[1]), _mm_packs_epi32(q[2], q[3]));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + k), bytes);
+    }
 
-    // Write the translated [0,255] value of each color component.
-    out << static_cast<int>(256 * clamp(r, 0.0, 0.999)) << ' '
-        << static_cast<int>(256 * clamp(g, 0.0, 0.999)) << ' '
-        << static_cast<int>(256 * clamp(b, 0.0, 0.999)) << '\n';
+    for (; k < count; k++) {
+        float x = linear[k] > 0.0f ? sqrtf(linear[k]) : 0.0f;
+        x = x < 0.999f ? x : 0.999f;
+        out[k] = static_cast<unsigned char>(256.0f * x);
+    }
 }
 
-#endif
\ No newline at end of file
+#endif
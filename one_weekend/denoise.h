@@ -0,0 +1,213 @@
+#ifndef DENOISE_H
+#define DENOISE_H
+
+#include "rtweekend.h"
+
+#include "color.h"
+#include "framebuffer.h"
+#include "packet.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+/**
+** Edge-avoiding a-trous wavelet filter (Dammertz et al. 2010) with the
+** variance guidance of SVGF (Schied et al. 2017). The noisy image is divided
+** by the first-hit albedo, so only the lighting is blurred, then filtered
+** with a 5x5 B3-spline kernel whose taps spread 1, 2, 4, 8 and 16 pixels
+** apart. Taps across a normal or depth edge, or with a luminance far outside
+** the noise of the center pixel, get little weight. Every feature is kept in
+** its own padded plane, so the filter runs packet_width pixels at a time
+** with plain unaligned loads and no bounds checks.
+*/
+class atrous_denoiser {
+    public:
+        static const int iterations = 5;
+        static const int margin = 2 << (iterations - 1);   // Reach of the widest step
+
+        atrous_denoiser(int width, int height);
+
+        // First-hit features of pixel (i, j), rows counted bottom-up like in
+        // the framebuffer: albedo 1 and normal 0 where the rays missed
+        void set_features(int i, int j, const color& albedo, const vec3& normal, real depth);
+
+        // Filters the means of image. The result is read with at().
+        void denoise(const framebuffer& image, thread_pool& pool);
+
+        color at(int i, int j) const {
+            size_t p = index(i, j);
+            return color(irradiance[0][p], irradiance[1][p], irradiance[2][p]) * modulation(p);
+        }
+
+    private:
+        size_t index(int i, int j) const { return size_t(j + margin) * stride + i + margin; }
+
+        // Albedo the lighting is divided by, kept away from 0 where the first
+        // hit absorbs everything
+        color modulation(size_t p) const {
+            return color(fmax(albedo[0][p], 0.01), fmax(albedo[1][p], 0.01), fmax(albedo[2][p], 0.01));
+        }
+
+        void filter_rows(int step, int j0, int j1);
+
+    private:
+        int width, height;
+        int stride;                         // Of a padded row, a whole number of packets
+        std::vector<real> albedo[3];
+        std::vector<real> normal[3];
+        std::vector<real> depth;
+        std::vector<real> depth_gradient;   // Depth change per pixel, for the depth tolerance
+        std::vector<real> inside;           // 1 in the image, 0 in the margin
+        std::vector<real> irradiance[3], filtered[3];
+        std::vector<real> variance, filtered_variance;
+};
+
+atrous_denoiser::atrous_denoiser(int width, int height) : width(width), height(height) {
+    // The last packet of a row may reach packet_width-1 pixels past the image
+    stride = (width + 2 * margin + 2 * packet_width - 1) / packet_width * packet_width;
+    size_t size = size_t(stride) * (height + 2 * margin);
+    for (int c = 0; c < 3; c++) {
+        albedo[c].assign(size, 1);
+        normal[c].assign(size, 0);
+        irradiance[c].assign(size, 0);
+        filtered[c].assign(size, 0);
+    }
+    depth.assign(size, 0);
+    depth_gradient.assign(size, 0);
+    inside.assign(size, 0);
+    variance.assign(size, 0);
+    filtered_variance.assign(size, 0);
+
+    for (int j = 0; j < height; j++)
+        std::fill_n(inside.begin() + index(0, j), width, 1);
+}
+
+void atrous_denoiser::set_features(int i, int j, const color& a, const vec3& n, real z) {
+    size_t p = index(i, j);
+    for (int c = 0; c < 3; c++) {
+        albedo[c][p] = a[c];
+        normal[c][p] = n[c];
+    }
+    depth[p] = z;
+}
+
+// exp(-x) for x >= 0, close enough for a weight and cheap on packets
+inline preal edge_weight(preal x) {
+    preal w = max(preal(0), preal(1) - x * preal(0.125));
+    w = w * w;
+    w = w * w;
+    return w * w;
+}
+
+void atrous_denoiser::denoise(const framebuffer& image, thread_pool& pool) {
+    const int band = 16;
+    int bands = (height + band - 1) / band;
+
+    // Lighting and the variance of its mean luminance, and the depth
+    // gradients of the features
+    pool.parallel_for(bands, [&](int b, int) {
+        for (int j = b * band; j < std::min(height, (b + 1) * band); j++) {
+            for (int i = 0; i < width; i++) {
+                size_t p = index(i, j);
+                const pixel_accumulator& pixel = image.at(i, j);
+                color a = modulation(p);
+                color m = pixel.mean();
+                color lighting(m.x() / a.x(), m.y() / a.y(), m.z() / a.z());
+                for (int c = 0; c < 3; c++)
+                    irradiance[c][p] = lighting[c];
+
+                real n = pixel.samples;
+                real mean = luminance(pixel.sum) / fmax(n, 1);
+                real sample_variance = n > 1 ? fmax(pixel.luminance_sq / n - mean*mean, 0) * n / (n - 1) : mean*mean;
+                real albedo_luminance = luminance(a);
+                variance[p] = sample_variance / fmax(n, 1) / (albedo_luminance * albedo_luminance);
+
+                int il = std::max(i - 1, 0), ir = std::min(i + 1, width - 1);
+                int jl = std::max(j - 1, 0), jr = std::min(j + 1, height - 1);
+                depth_gradient[p] = fmax(fabs(depth[index(ir, j)] - depth[index(il, j)]),
+                                         fabs(depth[index(i, jr)] - depth[index(i, jl)])) / 2;
+            }
+        }
+    });
+
+    for (int k = 0; k < iterations; k++) {
+        pool.parallel_for(bands, [&](int b, int) {
+            filter_rows(1 << k, b * band, std::min(height, (b + 1) * band));
+        });
+        for (int c = 0; c < 3; c++)
+            std::swap(irradiance[c], filtered[c]);
+        std::swap(variance, filtered_variance);
+    }
+}
+
+void atrous_denoiser::filter_rows(int step, int j0, int j1) {
+    const real kernel[5] = { 1.0/16, 1.0/4, 3.0/8, 1.0/4, 1.0/16 };
+    const real sigma_luminance = 4;
+    const real sigma_depth = 1;
+    const real blur[2] = { 1.0/2, 1.0/4 };
+
+    const preal rw(0.2126), gw(0.7152), bw(0.0722);
+
+    for (int j = j0; j < j1; j++) {
+        for (int i = 0; i < width; i += packet_width) {
+            size_t p = index(i, j);
+            preal r = preal::load(&irradiance[0][p]), g = preal::load(&irradiance[1][p]), b = preal::load(&irradiance[2][p]);
+            preal v = preal::load(&variance[p]);
+            preal nx = preal::load(&normal[0][p]), ny = preal::load(&normal[1][p]), nz = preal::load(&normal[2][p]);
+            preal z = preal::load(&depth[p]);
+            preal z_tolerance = preal(sigma_depth * step) * preal::load(&depth_gradient[p]) + preal(1e-4);
+            preal l = rw*r + gw*g + bw*b;
+
+            // A few samples estimate the variance poorly, a 3x3 blur of it steadies
+            // the luminance tolerance
+            preal v_blurred(0);
+            for (int dy = -1; dy <= 1; dy++)
+                for (int dx = -1; dx <= 1; dx++)
+                    v_blurred = v_blurred + preal(blur[abs(dx)] * blur[abs(dy)]) * preal::load(&variance[p + ptrdiff_t(dy) * stride + dx]);
+            preal l_tolerance = preal(sigma_luminance) * sqrt(v_blurred) + preal(1e-4);
+
+            // The center always counts in full, which also keeps the sums of
+            // pixels without features or in the margin from being zero
+            real center = kernel[2] * kernel[2];
+            preal sum_w(center), sum_r = preal(center) * r, sum_g = preal(center) * g, sum_b = preal(center) * b;
+            preal sum_v = preal(center * center) * v;
+
+            for (int dy = -2; dy <= 2; dy++) {
+                for (int dx = -2; dx <= 2; dx++) {
+                    if (dx == 0 && dy == 0)
+                        continue;
+                    size_t q = p + (ptrdiff_t(dy) * stride + dx) * step;
+                    preal qr = preal::load(&irradiance[0][q]), qg = preal::load(&irradiance[1][q]), qb = preal::load(&irradiance[2][q]);
+
+                    // Normals: cos^64 of the angle between them
+                    preal w_n = max(preal(0), nx * preal::load(&normal[0][q]) + ny * preal::load(&normal[1][q])
+                                              + nz * preal::load(&normal[2][q]));
+                    for (int s = 0; s < 6; s++)
+                        w_n = w_n * w_n;
+
+                    preal dz = preal::load(&depth[q]) - z;
+                    preal dl = rw*qr + gw*qg + bw*qb - l;
+                    preal x = max(dz, -dz) / (z_tolerance * preal(real(abs(dx) + abs(dy))))
+                            + max(dl, -dl) / l_tolerance;
+
+                    preal w = preal(kernel[dx + 2] * kernel[dy + 2]) * preal::load(&inside[q]) * w_n * edge_weight(x);
+                    sum_w = sum_w + w;
+                    sum_r = sum_r + w * qr;
+                    sum_g = sum_g + w * qg;
+                    sum_b = sum_b + w * qb;
+                    sum_v = sum_v + w * w * preal::load(&variance[q]);
+                }
+            }
+
+            preal inv = preal(1) / sum_w;
+            (sum_r * inv).store(&filtered[0][p]);
+            (sum_g * inv).store(&filtered[1][p]);
+            (sum_b * inv).store(&filtered[2][p]);
+            (sum_v * inv * inv).store(&filtered_variance[p]);
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,463 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include "rtweekend.h"
+
+#include "adaptive.h"
+#include "checkpoint.h"
+#include "framebuffer.h"
+#include "image_writer.h"
+#include "ray_stats.h"
+#include "sampler.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Rendering split across processes. A coordinator owns the image and deals
+// its tiles to workers, which connect to it over a Unix domain socket or TCP
+// and load the scene themselves. With every tile a worker gets the samples
+// accumulated in it so far and the budget to bring it to, and it sends the
+// tile back whole. The coordinator only replaces its copy, so the sums and
+// sample counts of a tile stay consistent whichever worker rendered it, and
+// the tiles of a worker that goes away can simply be dealt again. Messages
+// are in native byte order, since both ends run the same build.
+
+struct tile_hello {
+    char magic[8];          // "RTWDIST"
+    uint32_t version;
+    uint32_t real_size;     // Bytes per component of the pixel records
+    uint64_t scene_key;     // geometry_cache_key of the scene the worker loaded
+    int32_t width;
+    int32_t height;
+    int32_t tile_size;
+    int32_t threads;        // Tiles the worker renders at once
+    int32_t sampler;        // sampler_type of the worker
+    int32_t unused;
+};
+
+// Coordinator to worker, followed by count tiles: each an int32_t index and
+// the pixel records of the tile, rows bottom-up. A count of 0 asks the worker
+// to exit.
+struct tile_batch {
+    int32_t frame;
+    int32_t count;
+    int32_t min_samples;
+    int32_t max_samples;
+    int32_t strata;         // sampler::strata of the samples to take
+    int32_t unused;
+    double target_error;
+};
+
+// Worker to coordinator, followed by the tiles of the batch in the same order
+// and layout
+struct tile_results {
+    int32_t count;
+    int32_t unused;
+    ray_stats stats;        // Counters of the rays traced for the batch
+};
+
+const char tile_magic[8] = "RTWDIST";
+const uint32_t tile_protocol_version = 3;
+
+// Address of a TCP socket, "HOST:PORT" with HOST an IPv4 address or
+// localhost, or otherwise the path of a Unix domain socket
+struct socket_address {
+    sockaddr_storage storage;
+    socklen_t length;
+    std::string unix_path;  // Empty for TCP
+};
+
+inline bool parse_socket_address(const char* text, socket_address& address) {
+    address = socket_address();
+    const char* colon = strrchr(text, ':');
+    if (colon && colon[1] && strspn(colon + 1, "0123456789") == strlen(colon + 1)) {
+        std::string host(text, colon - text);
+        if (host.empty() || host == "localhost")
+            host = "127.0.0.1";
+        long port = strtol(colon + 1, nullptr, 10);
+        sockaddr_in* in = reinterpret_cast<sockaddr_in*>(&address.storage);
+        in->sin_family = AF_INET;
+        in->sin_port = htons(static_cast<uint16_t>(port));
+        if (port > 65535 || inet_pton(AF_INET, host.c_str(), &in->sin_addr) != 1) {
+            errno = EINVAL;
+            return false;
+        }
+        address.length = sizeof(sockaddr_in);
+        return true;
+    }
+
+    sockaddr_un* un = reinterpret_cast<sockaddr_un*>(&address.storage);
+    if (strlen(text) >= sizeof(un->sun_path)) {
+        errno = ENAMETOOLONG;
+        return false;
+    }
+    un->sun_family = AF_UNIX;
+    strcpy(un->sun_path, text);
+    address.length = sizeof(sockaddr_un);
+    address.unix_path = text;
+    return true;
+}
+
+// Messages are small and answered right away, don't let TCP hold them back
+inline void set_no_delay(int fd, const socket_address& address) {
+    int one = 1;
+    if (address.unix_path.empty())
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+// Listening socket at address, -1 on failure. A Unix domain socket left over
+// from an earlier run is replaced.
+inline int listen_socket(const socket_address& address) {
+    int fd = socket(address.storage.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+
+    int one = 1;
+    if (address.unix_path.empty())
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    else
+        unlink(address.unix_path.c_str());
+
+    if (bind(fd, reinterpret_cast<const sockaddr*>(&address.storage), address.length) < 0 || listen(fd, 64) < 0) {
+        int error = errno;
+        close(fd);
+        errno = error;
+        return -1;
+    }
+    return fd;
+}
+
+// Socket connected to address, -1 on failure. Retries for up to timeout
+// seconds while nothing listens there yet, so workers may start first.
+inline int connect_socket(const socket_address& address, double timeout) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(timeout);
+    for (;;) {
+        int fd = socket(address.storage.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+            return -1;
+        if (connect(fd, reinterpret_cast<const sockaddr*>(&address.storage), address.length) == 0) {
+            set_no_delay(fd, address);
+            return fd;
+        }
+
+        int error = errno;
+        close(fd);
+        errno = error;
+        if ((error != ECONNREFUSED && error != ENOENT) || std::chrono::steady_clock::now() > deadline)
+            return -1;
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+}
+
+// Appends the index and pixel records of a tile to message
+inline void append_tile(std::vector<char>& message, const framebuffer& image, int tile_index) {
+    framebuffer::tile t = image.tile_bounds(tile_index);
+    int32_t index = tile_index;
+    size_t start = message.size();
+    message.resize(start + sizeof(index) + size_t(t.x1 - t.x0) * (t.y1 - t.y0) * sizeof(checkpoint_record));
+    std::memcpy(message.data() + start, &index, sizeof(index));
+
+    char* out = message.data() + start + sizeof(index);
+    for (int j = t.y0; j < t.y1; j++) {
+        for (int i = t.x0; i < t.x1; i++, out += sizeof(checkpoint_record)) {
+            const pixel_accumulator& pixel = image.at(i, j);
+            checkpoint_record record = {};
+            record.sum[0] = pixel.sum.x();
+            record.sum[1] = pixel.sum.y();
+            record.sum[2] = pixel.sum.z();
+            record.luminance_sq = pixel.luminance_sq;
+            record.samples = pixel.samples;
+            std::memcpy(out, &record, sizeof(record));
+        }
+    }
+}
+
+// Reads a tile written by append_tile into records, without storing it.
+// Fails with EINVAL on an index that is not a tile of image.
+inline bool receive_tile(int fd, const framebuffer& image, int& tile_index, std::vector<checkpoint_record>& records) {
+    int32_t index;
+    if (!read_all(fd, &index, sizeof(index)))
+        return false;
+    if (index < 0 || index >= image.tile_count()) {
+        errno = EINVAL;
+        return false;
+    }
+
+    framebuffer::tile t = image.tile_bounds(index);
+    records.resize(size_t(t.x1 - t.x0) * (t.y1 - t.y0));
+    tile_index = index;
+    return read_all(fd, records.data(), records.size() * sizeof(checkpoint_record));
+}
+
+// Replaces the pixels of a tile with records read by receive_tile
+inline void store_tile(framebuffer& image, int tile_index, const std::vector<checkpoint_record>& records) {
+    framebuffer::tile t = image.tile_bounds(tile_index);
+    const checkpoint_record* in = records.data();
+    for (int j = t.y0; j < t.y1; j++) {
+        for (int i = t.x0; i < t.x1; i++, in++) {
+            pixel_accumulator& pixel = image.at(i, j);
+            pixel.sum = color(in->sum[0], in->sum[1], in->sum[2]);
+            pixel.luminance_sq = in->luminance_sq;
+            pixel.samples = in->samples;
+        }
+    }
+}
+
+inline tile_hello make_tile_hello(uint64_t scene_key, sampler_type sampler, const framebuffer& image, int threads) {
+    tile_hello hello = {};
+    std::memcpy(hello.magic, tile_magic, sizeof(hello.magic));
+    hello.version = tile_protocol_version;
+    hello.real_size = sizeof(real);
+    hello.scene_key = scene_key;
+    hello.width = image.width;
+    hello.height = image.height;
+    hello.tile_size = image.tile_size;
+    hello.threads = threads;
+    hello.sampler = static_cast<int32_t>(sampler);
+    return hello;
+}
+
+// Deals the tiles of image to the workers that connect to listen_fd. Workers
+// stay connected from one pass and frame to the next, and are told to exit
+// when the coordinator is destroyed.
+class tile_coordinator {
+    public:
+        tile_coordinator(int listen_fd, const socket_address& address, uint64_t scene_key, const sampler& pixel_sampler,
+                         framebuffer& image)
+            : listen_fd(listen_fd), address(address), scene_key(scene_key), pixel_sampler(pixel_sampler), image(image)
+        {
+            // A worker that dies must not take the coordinator with it
+            signal(SIGPIPE, SIG_IGN);
+        }
+
+        ~tile_coordinator();
+
+        tile_coordinator(const tile_coordinator&) = delete;
+        tile_coordinator& operator=(const tile_coordinator&) = delete;
+
+        // Brings every tile of image up to budget through the workers, and
+        // adds the counters of their rays to stats. Returns false on an error
+        // of the coordinator's own socket; workers that fail are dropped.
+        bool render_pass(int frame, const sample_budget& budget, ray_stats& stats);
+
+    private:
+        struct worker {
+            int fd;
+            int threads;
+            std::vector<int> tiles;     // Dealt and not yet returned
+        };
+
+        void accept_worker();
+        bool send_batch(worker& w, int frame, const sample_budget& budget, std::deque<int>& pending);
+        bool receive_results(worker& w, ray_stats& stats);
+        void drop_worker(size_t k, std::deque<int>& pending);
+
+    private:
+        int listen_fd;
+        socket_address address;
+        uint64_t scene_key;
+        sampler pixel_sampler;
+        framebuffer& image;
+        std::vector<worker> workers;
+        std::vector<char> message;
+        std::vector<checkpoint_record> records;
+};
+
+tile_coordinator::~tile_coordinator() {
+    tile_batch stop = {};
+    for (worker& w : workers) {
+        write_all(w.fd, &stop, sizeof(stop));
+        close(w.fd);
+    }
+}
+
+bool tile_coordinator::render_pass(int frame, const sample_budget& budget, ray_stats& stats) {
+    std::deque<int> pending;
+    for (int t = 0; t < image.tile_count(); t++)
+        pending.push_back(t);
+    int remaining = image.tile_count();
+
+    if (workers.empty())
+        std::cerr << "\rWaiting for workers" << std::flush;
+
+    std::vector<pollfd> fds;
+    while (remaining > 0) {
+        // Keep every idle worker busy
+        for (size_t k = 0; k < workers.size(); ) {
+            if (workers[k].tiles.empty() && !pending.empty() && !send_batch(workers[k], frame, budget, pending)) {
+                drop_worker(k, pending);
+                continue;
+            }
+            k++;
+        }
+
+        fds.assign(1, pollfd{ listen_fd, POLLIN, 0 });
+        for (const worker& w : workers)
+            fds.push_back(pollfd{ w.fd, POLLIN, 0 });
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+
+        // Backwards, so that dropping a worker leaves the others' entries in place
+        for (size_t k = workers.size(); k-- > 0; ) {
+            if (!fds[k + 1].revents)
+                continue;
+            int tiles = static_cast<int>(workers[k].tiles.size());
+            if (tiles > 0 && receive_results(workers[k], stats)) {
+                remaining -= tiles;
+                std::cerr << "\rSamples per pixel: " << budget.max_samples << ", tiles remaining: "
+                          << remaining << ' ' << std::flush;
+            } else {
+                drop_worker(k, pending);
+            }
+        }
+        if (fds[0].revents & POLLIN)
+            accept_worker();
+    }
+    return true;
+}
+
+void tile_coordinator::accept_worker() {
+    int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0)
+        return;
+    set_no_delay(fd, address);
+
+    tile_hello hello;
+    tile_hello expected = make_tile_hello(scene_key, pixel_sampler.type, image, 0);
+    if (!read_all(fd, &hello, sizeof(hello))
+        || std::memcmp(hello.magic, expected.magic, sizeof(hello.magic)) != 0
+        || hello.version != expected.version || hello.real_size != expected.real_size
+        || hello.scene_key != expected.scene_key || hello.sampler != expected.sampler || hello.width != expected.width
+        || hello.height != expected.height || hello.tile_size != expected.tile_size || hello.threads <= 0) {
+        std::cerr << "\rRejected a worker with another scene, build, sampler or tile size\n";
+        close(fd);
+        return;
+    }
+
+    workers.push_back({ fd, std::min(hello.threads, image.tile_count()), {} });
+    std::cerr << "\rWorker " << workers.size() << " connected, " << hello.threads << " threads\n";
+}
+
+bool tile_coordinator::send_batch(worker& w, int frame, const sample_budget& budget, std::deque<int>& pending) {
+    tile_batch batch = {};
+    batch.frame = frame;
+    batch.count = std::min(w.threads, static_cast<int>(pending.size()));
+    batch.min_samples = budget.min_samples;
+    batch.max_samples = budget.max_samples;
+    batch.strata = pixel_sampler.strata;
+    batch.target_error = budget.target_error;
+
+    message.assign(reinterpret_cast<const char*>(&batch), reinterpret_cast<const char*>(&batch) + sizeof(batch));
+    for (int k = 0; k < batch.count; k++) {
+        w.tiles.push_back(pending.front());
+        pending.pop_front();
+        append_tile(message, image, w.tiles.back());
+    }
+    return write_all(w.fd, message.data(), message.size());
+}
+
+bool tile_coordinator::receive_results(worker& w, ray_stats& stats) {
+    tile_results results;
+    if (!read_all(w.fd, &results, sizeof(results)))
+        return false;
+    if (results.count != static_cast<int>(w.tiles.size())) {
+        errno = EINVAL;
+        return false;
+    }
+
+    // Tiles come back in the order they were dealt
+    for (int k = 0; k < results.count; k++) {
+        int tile_index;
+        if (!receive_tile(w.fd, image, tile_index, records))
+            return false;
+        if (tile_index != w.tiles[k]) {
+            errno = EINVAL;
+            return false;
+        }
+        store_tile(image, tile_index, records);
+    }
+    stats.merge(results.stats);
+    w.tiles.clear();
+    return true;
+}
+
+void tile_coordinator::drop_worker(size_t k, std::deque<int>& pending) {
+    worker& w = workers[k];
+    if (!w.tiles.empty())
+        std::cerr << "\rLost a worker, dealing its " << w.tiles.size() << " tiles again\n";
+    else
+        std::cerr << "\rLost an idle worker\n";
+
+    // Tiles stored before the worker failed are already up to budget, and
+    // come back quickly
+    pending.insert(pending.begin(), w.tiles.begin(), w.tiles.end());
+    close(w.fd);
+    workers.erase(workers.begin() + k);
+}
+
+// Renders the batches the coordinator at fd deals until it says to stop or
+// goes away. render_batch(frame, budget, strata, tiles, stats) renders the
+// given tiles of image with the given sampler strata and adds the counters
+// of their rays to stats. Returns false
+// with errno set when a message cannot be sent or is malformed.
+template <typename F>
+bool serve_tiles(int fd, framebuffer& image, F&& render_batch) {
+    std::vector<int> tiles;
+    std::vector<char> message;
+    std::vector<checkpoint_record> records;
+    for (bool first = true; ; first = false) {
+        // A coordinator that rejects a worker closes the connection before
+        // dealing it anything
+        tile_batch batch;
+        if (!read_all(fd, &batch, sizeof(batch))) {
+            errno = ECONNREFUSED;
+            return !first;
+        }
+        if (batch.count == 0)
+            return true;
+        if (batch.count < 0 || batch.count > image.tile_count() || batch.strata <= 0) {
+            errno = EINVAL;
+            return false;
+        }
+
+        tiles.clear();
+        for (int k = 0; k < batch.count; k++) {
+            int tile_index;
+            if (!receive_tile(fd, image, tile_index, records))
+                return false;
+            store_tile(image, tile_index, records);
+            tiles.push_back(tile_index);
+        }
+
+        tile_results results = {};
+        results.count = batch.count;
+        sample_budget budget = { batch.min_samples, batch.max_samples, batch.target_error };
+        render_batch(batch.frame, budget, batch.strata, tiles, results.stats);
+
+        message.assign(reinterpret_cast<const char*>(&results), reinterpret_cast<const char*>(&results) + sizeof(results));
+        for (int t : tiles)
+            append_tile(message, image, t);
+        if (!write_all(fd, message.data(), message.size()))
+            return false;
+    }
+}
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef FLAT_ARRAY_H
+#define FLAT_ARRAY_H
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// Array of plain values behind the geometry kernels. It owns its elements,
+// and can grow, while a scene is built; or it is a read-only view of
+// elements that live elsewhere, such as a mapped geometry cache, which are
+// then used in place. Either way the kernels read it through one pointer.
+template <typename T>
+class flat_array {
+    public:
+        flat_array() {}
+
+        // View of count elements owned by someone else
+        flat_array(const T* elements, size_t count) : first(elements), count(count) {}
+
+        // Copies would point into the original's elements
+        flat_array(const flat_array&) = delete;
+        flat_array& operator=(const flat_array&) = delete;
+
+        flat_array(flat_array&& a) noexcept { *this = std::move(a); }
+        flat_array& operator=(flat_array&& a) noexcept {
+            bool view = a.is_view();
+            owned = std::move(a.owned);
+            first = view ? a.first : owned.data();
+            count = a.count;
+            a.first = nullptr;
+            a.count = 0;
+            return *this;
+        }
+
+        const T& operator[](size_t i) const { return first[i]; }
+        const T* data() const { return first; }
+        size_t size() const { return count; }
+        bool empty() const { return count == 0; }
+
+        bool is_view() const { return first != nullptr && first != owned.data(); }
+
+        // Building, on owned elements only; a view becomes an owned copy
+        void push_back(const T& x) {
+            own();
+            owned.push_back(x);
+            sync();
+        }
+
+        void resize(size_t n, const T& x = T()) {
+            own();
+            owned.resize(n, x);
+            sync();
+        }
+
+        void assign(std::vector<T>&& elements) {
+            owned = std::move(elements);
+            sync();
+        }
+
+        // Elements to change in place
+        T* mutable_data() {
+            own();
+            sync();
+            return owned.data();
+        }
+
+    private:
+        void own() {
+            if (is_view())
+                owned.assign(first, first + count);
+        }
+
+        void sync() {
+            first = owned.data();
+            count = owned.size();
+        }
+
+    private:
+        std::vector<T> owned;
+        const T* first = nullptr;
+        size_t count = 0;
+};
+
+#endif
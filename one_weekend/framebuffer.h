@@ -0,0 +1,118 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include "rtweekend.h"
+#include "color.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+
+// Running sums over the samples of one pixel: enough for the mean color and
+// the variance of the mean luminance.
+struct pixel_accumulator {
+    color sum;
+    real luminance_sq = 0;     // Sum of the squared sample luminances
+    int samples = 0;
+
+    void add(const color& sample) {
+        sum += sample;
+        real y = luminance(sample);
+        luminance_sq += y*y;
+        samples++;
+    }
+
+    color mean() const {
+        return samples > 0 ? sum / samples : color(0,0,0);
+    }
+
+    // Standard error of the mean luminance relative to the mean. The offset
+    // keeps near-black pixels from asking for every sample they can get.
+    real relative_error() const {
+        if (samples < 2)
+            return infinity;
+        real mean = luminance(sum) / samples;
+        real variance = (luminance_sq / samples - mean*mean) * samples / (samples - 1);
+        return sqrt(fmax(variance, 0.0) / samples) / (mean + 0.01);
+    }
+};
+
+// Accumulation buffer split into square tiles. Each tile is stored contiguously
+// and starts on its own cache line, so threads rendering different tiles never
+// write to the same line.
+class framebuffer {
+    public:
+        struct tile {
+            int x0, y0;     // Lower left pixel, rows count bottom-up like in the image loop
+            int x1, y1;     // One past the upper right pixel
+        };
+
+        framebuffer(int width, int height, int tile_size)
+            : width(width), height(height), tile_size(tile_size)
+        {
+            tiles_x = (width + tile_size - 1) / tile_size;
+            tiles_y = (height + tile_size - 1) / tile_size;
+
+            // Round every tile up to a whole number of cache lines
+            size_t bytes = tile_size * tile_size * sizeof(pixel_accumulator);
+            size_t stride_bytes = (bytes + cache_line - 1) / cache_line * cache_line;
+            while (stride_bytes % sizeof(pixel_accumulator) != 0)
+                stride_bytes += cache_line;
+            tile_stride = stride_bytes / sizeof(pixel_accumulator);
+
+            size_t total = tile_stride * tile_count();
+            pixels = static_cast<pixel_accumulator*>(std::aligned_alloc(cache_line, total * sizeof(pixel_accumulator)));
+            std::uninitialized_fill_n(pixels, total, pixel_accumulator());
+        }
+
+        ~framebuffer() { std::free(pixels); }
+
+        framebuffer(const framebuffer&) = delete;
+        framebuffer& operator=(const framebuffer&) = delete;
+
+        int tile_count() const { return tiles_x * tiles_y; }
+
+        // Back to no samples in any pixel
+        void clear() { std::fill_n(pixels, tile_stride * tile_count(), pixel_accumulator()); }
+
+        // Tiles are numbered from the top of the image down, so that finished
+        // tiles come in roughly the order the image is written out
+        tile tile_bounds(int index) const {
+            int tx = index % tiles_x;
+            int ty = index / tiles_x;
+            int y1 = height - ty * tile_size;
+            return { tx * tile_size, std::max(0, y1 - tile_size),
+                     std::min(width, (tx + 1) * tile_size), y1 };
+        }
+
+        // Pixel (i, j) of the tile that contains it
+        pixel_accumulator& at(int i, int j) {
+            return pixels[offset(i, j)];
+        }
+
+        const pixel_accumulator& at(int i, int j) const {
+            return pixels[offset(i, j)];
+        }
+
+    public:
+        int width;
+        int height;
+        int tile_size;
+
+    private:
+        static const size_t cache_line = 64;
+
+        size_t offset(int i, int j) const {
+            int row_from_top = height - 1 - j;
+            int tile_index = (row_from_top / tile_size) * tiles_x + i / tile_size;
+            return tile_index * tile_stride + (row_from_top % tile_size) * tile_size + i % tile_size;
+        }
+
+    private:
+        int tiles_x;
+        int tiles_y;
+        size_t tile_stride;
+        pixel_accumulator* pixels;
+};
+
+#endif
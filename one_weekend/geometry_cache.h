@@ -0,0 +1,480 @@
+#ifndef GEOMETRY_CACHE_H
+#define GEOMETRY_CACHE_H
+
+#include "rtweekend.h"
+
+#include "flat_array.h"
+#include "image_writer.h"
+#include "packet.h"
+#include "scene.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A geometry cache holds a built scene: its settings, materials and the
+// flattened arrays and BVH nodes of its primitives and meshes, as they are in
+// memory. Loading one maps the file and points the arrays into it, so the
+// scene is neither parsed nor built and nothing is copied; pages are read as
+// the first rays touch them.
+//
+// The file is this header, a table of arrays and the arrays themselves, each
+// aligned to 64 bytes, in native byte order. The key is a hash of the scene
+// source (see geometry_cache_key), and the OBJ files of the scene are
+// checked against the content hash stored with each mesh, so a cache never
+// outlives the files it was built from. Past its header and table, every
+// index a ray or a shader follows is checked once at load, so a damaged
+// cache is rebuilt instead of read out of bounds.
+
+struct geometry_cache_header {
+    char magic[8];          // "RTWGEOM"
+    uint32_t version;
+    uint32_t real_size;     // Bytes per real
+    uint32_t vec3_size;     // Bytes per vec3, which depends on the math backend
+    uint32_t packet_width;  // Padding and leaf sizes depend on it
+    uint64_t key;
+    uint32_t array_count;
+    uint32_t unused;
+};
+
+struct geometry_cache_array {
+    uint64_t offset;        // From the start of the file
+    uint64_t count;
+    uint32_t element_size;
+    uint32_t unused;
+};
+
+// Settings of the scene_desc a cache was built from
+struct geometry_cache_settings {
+    int image_width;
+    real aspect_ratio;
+    int samples_per_pixel;
+    int max_depth;
+    camera_settings camera;
+    real orbit;
+    bool has_background;
+    color background;
+};
+
+const char geometry_cache_magic[8] = "RTWGEOM";
+const uint32_t geometry_cache_version = 4;
+const size_t geometry_cache_alignment = 64;
+
+// A whole file mapped read-only, unmapped on destruction
+class mapped_file {
+    public:
+        mapped_file() {}
+        ~mapped_file() { unmap(); }
+
+        mapped_file(const mapped_file&) = delete;
+        mapped_file& operator=(const mapped_file&) = delete;
+
+        bool map(const char* path) {
+            unmap();
+            int fd = open(path, O_RDONLY);
+            if (fd < 0)
+                return false;
+
+            struct stat info;
+            bool ok = fstat(fd, &info) == 0;
+            if (ok && info.st_size > 0) {
+                void* p = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                ok = p != MAP_FAILED;
+                if (ok) {
+                    bytes = static_cast<const char*>(p);
+                    length = info.st_size;
+                }
+            }
+
+            int saved_errno = errno;
+            close(fd);
+            errno = saved_errno;
+            return ok;
+        }
+
+        void unmap() {
+            if (bytes)
+                munmap(const_cast<char*>(bytes), length);
+            bytes = nullptr;
+            length = 0;
+        }
+
+        const char* data() const { return bytes; }
+        size_t size() const { return length; }
+
+    private:
+        const char* bytes = nullptr;
+        size_t length = 0;
+};
+
+// 64-bit hash of a block of memory, eight bytes at a time over four
+// independent lanes
+inline uint64_t hash_bytes(const void* data, size_t size, uint64_t seed = 0) {
+    const char* p = static_cast<const char*>(data);
+    const uint64_t prime = 0x9e3779b97f4a7c15ULL;
+    uint64_t lanes[4] = { seed, seed + prime, seed + 2*prime, seed + 3*prime };
+
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        for (int k = 0; k < 4; k++) {
+            uint64_t word;
+            std::memcpy(&word, p + i + 8*k, 8);
+            lanes[k] = (lanes[k] ^ word) * prime;
+            lanes[k] ^= lanes[k] >> 29;
+        }
+    }
+
+    uint64_t tail[4] = {};
+    if (size > i)
+        std::memcpy(tail, p + i, size - i);
+    uint64_t h = size;
+    for (int k = 0; k < 4; k++)
+        h = hash_uint64(h ^ hash_uint64(lanes[k] ^ tail[k]));
+    return h;
+}
+
+inline bool hash_file(const char* path, uint64_t& hash) {
+    mapped_file file;
+    if (!file.map(path))
+        return false;
+    hash = hash_bytes(file.data(), file.size());
+    return true;
+}
+
+// Key of the geometry built from the scene file at scene_path, or from the
+// generated scene of the given grid when it is null, plus the OBJ file given
+// on the command line, if any. Geometry depends on the math backend and the
+// packet width too, so every build of the renderer has its own caches.
+inline bool geometry_cache_key(const char* scene_path, int grid, const char* obj_path, uint64_t& key) {
+    std::string build = std::string(math_backend::name()) + ' ' + std::to_string(sizeof(real))
+                      + ' ' + std::to_string(packet_width) + ' ' + std::to_string(geometry_cache_version);
+    key = hash_bytes(build.data(), build.size());
+
+    uint64_t source = hash_uint64(uint64_t(grid));
+    if (scene_path && !hash_file(scene_path, source))
+        return false;
+    key = hash_uint64(key ^ source);
+
+    if (obj_path)
+        key = hash_bytes(obj_path, strlen(obj_path), key);
+    return true;
+}
+
+// Collects the arrays of a scene, then writes them out in order
+class geometry_cache_writer {
+    public:
+        template <typename T>
+        void add(const T* data, size_t count) {
+            static_assert(std::is_trivially_copyable<T>::value, "cached arrays hold plain values");
+            arrays.push_back({ data, { 0, count, sizeof(T), 0 } });
+        }
+
+        template <typename T>
+        void operator()(const flat_array<T>& a) { add(a.data(), a.size()); }
+        void operator()(const int& x) { add(&x, 1); }
+
+        bool write(const char* path, uint64_t key) const;
+
+    private:
+        struct pending_array {
+            const void* data;
+            geometry_cache_array entry;
+        };
+        std::vector<pending_array> arrays;
+};
+
+// Hands out the arrays of a mapped cache in the order they were written.
+// ok turns false on the first array that is missing or of the wrong type.
+class geometry_cache_reader {
+    public:
+        geometry_cache_reader(const mapped_file& file, const geometry_cache_array* table, uint32_t count)
+            : file(file), table(table), count(count) {}
+
+        template <typename T>
+        bool next(const T*& data, size_t& n) {
+            if (!ok || index == count || table[index].element_size != sizeof(T)) {
+                ok = false;
+                return false;
+            }
+            const geometry_cache_array& a = table[index++];
+            data = reinterpret_cast<const T*>(file.data() + a.offset);
+            n = a.count;
+            return true;
+        }
+
+        template <typename T>
+        void operator()(flat_array<T>& a) {
+            const T* data;
+            size_t n;
+            if (next(data, n))
+                a = flat_array<T>(data, n);
+        }
+
+        void operator()(int& x) {
+            const int* data;
+            size_t n;
+            if (next(data, n) && n == 1)
+                x = *data;
+            else
+                ok = false;
+        }
+
+    public:
+        bool ok = true;
+
+    private:
+        const mapped_file& file;
+        const geometry_cache_array* table;
+        uint32_t count;
+        uint32_t index = 0;
+};
+
+bool geometry_cache_writer::write(const char* path, uint64_t key) const {
+    geometry_cache_header header = {};
+    std::memcpy(header.magic, geometry_cache_magic, sizeof(header.magic));
+    header.version = geometry_cache_version;
+    header.real_size = sizeof(real);
+    header.vec3_size = sizeof(vec3);
+    header.packet_width = packet_width;
+    header.key = key;
+    header.array_count = static_cast<uint32_t>(arrays.size());
+
+    auto align = [](uint64_t offset) {
+        return (offset + geometry_cache_alignment - 1) / geometry_cache_alignment * geometry_cache_alignment;
+    };
+
+    std::vector<geometry_cache_array> table;
+    uint64_t offset = align(sizeof(header) + arrays.size() * sizeof(geometry_cache_array));
+    for (const pending_array& a : arrays) {
+        table.push_back(a.entry);
+        table.back().offset = offset;
+        offset = align(offset + a.entry.count * a.entry.element_size);
+    }
+
+    // Written under a temporary name and renamed into place, so that readers
+    // never see half a cache, nor processes building the same scene each
+    // other's
+    std::string temporary = std::string(path) + "." + std::to_string(getpid()) + ".tmp";
+    int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+
+    static const char padding[geometry_cache_alignment] = {};
+    uint64_t written = sizeof(header) + table.size() * sizeof(geometry_cache_array);
+    bool ok = write_all(fd, &header, sizeof(header))
+              && write_all(fd, table.data(), table.size() * sizeof(geometry_cache_array));
+    for (size_t k = 0; ok && k < arrays.size(); k++) {
+        size_t size = table[k].count * table[k].element_size;
+        ok = write_all(fd, padding, table[k].offset - written) && write_all(fd, arrays[k].data, size);
+        written = table[k].offset + size;
+    }
+
+    ok = close(fd) == 0 && ok;
+    return ok && rename(temporary.c_str(), path) == 0;
+}
+
+// Writes the geometry of a scene built by build_scene to a cache at path
+bool save_geometry_cache(const char* path, uint64_t key, const scene_desc& scene, scene_world& world) {
+    geometry_cache_settings settings = { scene.image_width, scene.aspect_ratio, scene.samples_per_pixel,
+                                         scene.max_depth, scene.camera, scene.orbit,
+                                         scene.has_background, scene.background };
+
+    // OBJ files are stored by path and content hash, meshes then assets
+    std::vector<const std::string*> obj_paths;
+    for (const obj_desc& obj : scene.meshes)
+        obj_paths.push_back(&obj.path);
+    int asset_count = world.instances ? static_cast<int>(scene.assets.size()) : 0;
+    for (int a = 0; a < asset_count; a++)
+        obj_paths.push_back(&scene.assets[a]);
+    std::vector<uint64_t> obj_hashes(obj_paths.size());
+    for (size_t k = 0; k < obj_paths.size(); k++)
+        if (!hash_file(obj_paths[k]->c_str(), obj_hashes[k]))
+            return false;
+    auto add_obj = [&](geometry_cache_writer& writer, size_t k) {
+        writer.add(obj_paths[k]->c_str(), obj_paths[k]->size() + 1);
+        writer.add(&obj_hashes[k], 1);
+    };
+
+    geometry_cache_writer writer;
+    writer.add(&settings, 1);
+    writer.add(scene.materials.data(), scene.materials.size());
+    writer.add(scene.motions.data(), scene.motions.size());
+    world.primitives->for_each_array(writer);
+
+    int mesh_count = static_cast<int>(scene.meshes.size());
+    writer(mesh_count);
+    for (int m = 0; m < mesh_count; m++) {
+        writer(scene.meshes[m].material);
+        add_obj(writer, m);
+        world.meshes[m]->for_each_array(writer);
+    }
+
+    writer(asset_count);
+    for (int a = 0; a < asset_count; a++) {
+        add_obj(writer, mesh_count + a);
+        static_cast<triangle_mesh&>(*world.instances->prototypes[a]).for_each_array(writer);
+    }
+    if (asset_count > 0)
+        world.instances->for_each_array(writer);
+
+    return writer.write(path, key);
+}
+
+// Whether the settings, materials and motions of a scene read from a cache
+// are in range, and its geometry is consistent: material, vertex and
+// primitive indices, padding and trees
+inline bool valid_cached_scene(const scene_desc& scene, const scene_world& world) {
+    if (scene.image_width <= 0 || !(scene.aspect_ratio > 0) || scene.samples_per_pixel <= 0 || scene.max_depth <= 0)
+        return false;
+    for (const material_desc& m : scene.materials)
+        if (static_cast<int>(m.type) < 0 || static_cast<int>(m.type) >= material_type_count)
+            return false;
+    size_t instance_count = world.instances ? world.instances->instances.size() : 0;
+    for (const motion_desc& m : scene.motions)
+        if (m.instance < 0 || size_t(m.instance) >= instance_count)
+            return false;
+
+    if (!world.primitives->valid())
+        return false;
+    for (const shared_ptr<triangle_mesh>& mesh : world.meshes)
+        if (!mesh->valid())
+            return false;
+    if (world.instances) {
+        for (const shared_ptr<hittable>& prototype : world.instances->prototypes)
+            if (!static_cast<const triangle_mesh&>(*prototype).valid())
+                return false;
+        if (!world.instances->valid())
+            return false;
+    }
+    return true;
+}
+
+// Maps the cache at path into file and sets up scene and world from it: the
+// settings, materials, motions, OBJ meshes and assets of scene, without its
+// spheres, triangles and instances, and the geometry of world as views of file, which
+// has to outlive it. Fails with ENOENT when there is no cache, and with
+// EINVAL when it does not match key, one of its OBJ files changed or its
+// contents are damaged.
+bool load_geometry_cache(const char* path, uint64_t key, mapped_file& file, scene_desc& scene, scene_world& world) {
+    if (!file.map(path))
+        return false;
+
+    geometry_cache_header header;
+    bool ok = file.size() >= sizeof(header);
+    if (ok) {
+        std::memcpy(&header, file.data(), sizeof(header));
+        ok = std::memcmp(header.magic, geometry_cache_magic, sizeof(header.magic)) == 0
+             && header.version == geometry_cache_version && header.real_size == sizeof(real)
+             && header.vec3_size == sizeof(vec3) && header.packet_width == uint32_t(packet_width)
+             && header.key == key
+             && file.size() >= sizeof(header) + uint64_t(header.array_count) * sizeof(geometry_cache_array);
+    }
+
+    const geometry_cache_array* table = reinterpret_cast<const geometry_cache_array*>(file.data() + sizeof(header));
+    for (uint32_t k = 0; ok && k < header.array_count; k++) {
+        const geometry_cache_array& a = table[k];
+        ok = a.offset % geometry_cache_alignment == 0 && a.element_size > 0 && a.offset <= file.size()
+             && a.count <= (file.size() - a.offset) / a.element_size;
+    }
+    if (!ok) {
+        file.unmap();
+        errno = EINVAL;
+        return false;
+    }
+
+    geometry_cache_reader reader(file, table, header.array_count);
+    const geometry_cache_settings* settings;
+    const material_desc* materials;
+    const motion_desc* motions;
+    size_t n = 0, material_count = 0;
+    scene = scene_desc();
+    if (reader.next(settings, n) && n == 1 && reader.next(materials, material_count) && reader.next(motions, n)) {
+        scene.image_width = settings->image_width;
+        scene.aspect_ratio = settings->aspect_ratio;
+        scene.samples_per_pixel = settings->samples_per_pixel;
+        scene.max_depth = settings->max_depth;
+        scene.camera = settings->camera;
+        scene.orbit = settings->orbit;
+        scene.has_background = settings->has_background;
+        scene.background = settings->background;
+        scene.materials.assign(materials, materials + material_count);
+        scene.motions.assign(motions, motions + n);
+    }
+
+    // Path of an OBJ file, which must still have the stored content hash
+    auto read_obj = [&](std::string& obj_path) {
+        const char* chars;
+        const uint64_t* stored_hash;
+        uint64_t hash;
+        if (!reader.next(chars, n) || n == 0 || chars[n - 1] != '\0'
+            || !reader.next(stored_hash, n) || n != 1 || !hash_file(chars, hash) || hash != *stored_hash)
+            reader.ok = false;
+        else
+            obj_path = chars;
+        return reader.ok;
+    };
+
+    std::vector<const material*> table_materials = add_materials(scene, world.materials);
+    world.primitives = make_shared<primitive_store>();
+    for (const material* m : table_materials)
+        world.primitives->add_material(m);
+    world.primitives->for_each_array(reader);
+    world.world.add(world.primitives);
+
+    int mesh_count = 0;
+    reader(mesh_count);
+    for (int m = 0; reader.ok && m < mesh_count; m++) {
+        obj_desc obj;
+        reader(obj.material);
+        if (!read_obj(obj.path) || obj.material < 0 || obj.material >= int(material_count)) {
+            reader.ok = false;
+            break;
+        }
+        scene.meshes.push_back(obj);
+
+        auto mesh = make_shared<triangle_mesh>();
+        mesh->mat_ptr = table_materials[obj.material];
+        mesh->for_each_array(reader);
+        world.meshes.push_back(mesh);
+        world.world.add(mesh);
+    }
+
+    int asset_count = 0;
+    reader(asset_count);
+    if (reader.ok && asset_count > 0) {
+        world.instances = make_shared<instance_group>();
+        for (const material* m : table_materials)
+            world.instances->add_material(m);
+        for (int a = 0; a < asset_count; a++) {
+            scene.assets.emplace_back();
+            if (!read_obj(scene.assets.back()))
+                break;
+            auto mesh = make_shared<triangle_mesh>();
+            mesh->for_each_array(reader);
+            world.instances->add_prototype(mesh);
+        }
+        world.instances->for_each_array(reader);
+        world.world.add(world.instances);
+    }
+
+    if (!reader.ok || !valid_cached_scene(scene, world)) {
+        world = scene_world();
+        file.unmap();
+        errno = EINVAL;
+        return false;
+    }
+
+    world.lights.has_background = scene.has_background;
+    world.lights.background = scene.background;
+    world.lights.collect(*world.primitives);
+    return true;
+}
+
+#endif
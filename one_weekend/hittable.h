@@ -3,13 +3,19 @@
 
 #include "rtweekend.h"
 
+#include "aabb.h"
+#include "packet.h"
+
+#include <type_traits>
+
 class material;
 
 struct hit_record {
     point3 p;
     vec3 normal;
-    shared_ptr<material> mat_ptr;
-    double t;
+    const material* mat_ptr;
+    int light;              // Index in the scene's light list, -1 if it is not one
+    real t;
     bool front_face;
 
     inline void set_face_normal(const ray& r, const vec3& outward_normal) {
@@ -18,10 +24,42 @@ struct hit_record {
     }
 };
 
+// Records are copied for every candidate hit, they must stay plain data
+static_assert(std::is_trivially_copyable<hit_record>::value, "hit_record must be trivially copyable");
+
 class hittable {
     public:
-        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec)
+        virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec)
             const = 0;
+
+        virtual bool bounding_box(aabb& output_box) const = 0;
+
+        // Any-hit query for shadow rays: whether anything lies along r within
+        // [t_min, t_max]. Returns at the first hit found, nearest or not, and
+        // fills no record. Falls back to hit().
+        virtual bool occluded(const ray& r, real t_min, real t_max) const {
+            hit_record rec;
+            return hit(r, t_min, t_max, rec);
+        }
+
+        // Packet query for the lanes set in active. Every lane that hits gets
+        // its record in rec[lane] and its t_max narrowed; the mask of those
+        // lanes is returned. Falls back to one hit() call per lane.
+        virtual int hit_packet(const ray_packet& r, real t_min, preal& t_max, hit_record* rec, int active) const {
+            alignas(32) real t[packet_width];
+            t_max.store(t);
+
+            int hits = 0;
+            for (int i = 0; i < packet_width; i++) {
+                if (((active >> i) & 1) && hit(r.rays[i], t_min, t[i], rec[i])) {
+                    t[i] = rec[i].t;
+                    hits |= 1 << i;
+                }
+            }
+
+            t_max = preal::load(t);
+            return hits;
+        }
 };
 
 #endif
\ No newline at end of file
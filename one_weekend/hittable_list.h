@@ -17,17 +17,24 @@ class hittable_list : public hittable {
         void clear() { objects.clear(); }
         void add(shared_ptr<hittable> object) { objects.push_back(object); }
 
-        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec)
+        virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec)
+            const override;
+
+        virtual bool bounding_box(aabb& output_box) const override;
+
+        virtual bool occluded(const ray& r, real t_min, real t_max) const override;
+
+        virtual int hit_packet(const ray_packet& r, real t_min, preal& t_max, hit_record* rec, int active)
             const override;
 
     public:
         std::vector<shared_ptr<hittable>> objects;
 };
 
-bool hittable_list::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+bool hittable_list::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
     hit_record temp_rec;
     bool hit_anything = false;
-    double closest_so_far = t_max;
+    real closest_so_far = t_max;
 
     for (const auto& object : objects) {
         if (object->hit(r, t_min, closest_so_far, temp_rec)) {
@@ -40,4 +47,35 @@ bool hittable_list::hit(const ray& r, double t_min, double t_max, hit_record& re
     return hit_anything;
 }
 
+bool hittable_list::occluded(const ray& r, real t_min, real t_max) const {
+    for (const auto& object : objects)
+        if (object->occluded(r, t_min, t_max))
+            return true;
+    return false;
+}
+
+int hittable_list::hit_packet(const ray_packet& r, real t_min, preal& t_max, hit_record* rec, int active) const {
+    int hits = 0;
+
+    for (const auto& object : objects)
+        hits |= object->hit_packet(r, t_min, t_max, rec, active);
+
+    return hits;
+}
+
+bool hittable_list::bounding_box(aabb& output_box) const {
+    if (objects.empty()) return false;
+
+    aabb temp_box;
+    bool first_box = true;
+
+    for (const auto& object : objects) {
+        if (!object->bounding_box(temp_box)) return false;
+        output_box = first_box ? temp_box : surrounding_box(output_box, temp_box);
+        first_box = false;
+    }
+
+    return true;
+}
+
 #endif
\ No newline at end of file
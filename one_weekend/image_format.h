@@ -0,0 +1,20 @@
+#ifndef IMAGE_FORMAT_H
+#define IMAGE_FORMAT_H
+
+#include <cstring>
+
+enum class image_format {
+    ppm,    // Binary P6, gamma-2 encoded 8-bit
+    pfm,    // Portable float map, linear RGB
+    exr     // Uncompressed scanline OpenEXR, linear 32-bit float RGB
+};
+
+inline bool parse_image_format(const char* name, image_format& format) {
+    if (!strcmp(name, "ppm")) format = image_format::ppm;
+    else if (!strcmp(name, "pfm")) format = image_format::pfm;
+    else if (!strcmp(name, "exr")) format = image_format::exr;
+    else return false;
+    return true;
+}
+
+#endif
@@ -0,0 +1,218 @@
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include "rtweekend.h"
+
+#include "color.h"
+#include "framebuffer.h"
+#include "image_format.h"
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+// Writes all of data to a file descriptor, retrying on short writes
+inline bool write_all(int fd, const void* data, size_t size) {
+    const char* p = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t n = ::write(fd, p, size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+// Streams an image to a file descriptor one band of rows at a time, so that
+// every band costs a single write() call.
+class image_writer {
+    public:
+        image_writer(int fd, image_format format, int width, int height)
+            : fd(fd), format(format), width(width), height(height) {}
+
+        // PFM stores the bottom row first, the other formats the top one
+        bool bottom_up() const { return format == image_format::pfm; }
+
+        bool write_header();
+
+        // rgb holds rows*width linear pixels, in file order
+        bool write_rows(const float* rgb, int rows);
+
+    private:
+        template <typename T>
+        void append(const T& value) {
+            const char* p = reinterpret_cast<const char*>(&value);
+            buffer.insert(buffer.end(), p, p + sizeof(T));
+        }
+
+        void append(const char* text) {
+            buffer.insert(buffer.end(), text, text + strlen(text) + 1);
+        }
+
+        void append_attribute(const char* name, const char* type, int size) {
+            append(name);
+            append(type);
+            append(int32_t(size));
+        }
+
+    private:
+        int fd;
+        image_format format;
+        int width;
+        int height;
+        int rows_written = 0;
+        std::vector<char> buffer;
+};
+
+bool image_writer::write_header() {
+    buffer.clear();
+
+    if (format == image_format::ppm) {
+        std::string header = "P6\n" + std::to_string(width) + ' ' + std::to_string(height) + "\n255\n";
+        buffer.assign(header.begin(), header.end());
+    } else if (format == image_format::pfm) {
+        // A negative scale marks little-endian data
+        std::string header = "PF\n" + std::to_string(width) + ' ' + std::to_string(height) + "\n-1.0\n";
+        buffer.assign(header.begin(), header.end());
+    } else {
+        append(int32_t(20000630));      // Magic number
+        append(int32_t(2));             // Version 2, single-part scanline file
+
+        // Channels are stored in alphabetical order
+        append_attribute("channels", "chlist", 3 * 18 + 1);
+        for (const char* name : { "B", "G", "R" }) {
+            append(name);
+            append(int32_t(2));         // FLOAT
+            append(int32_t(0));         // pLinear and reserved bytes
+            append(int32_t(1));         // x sampling
+            append(int32_t(1));         // y sampling
+        }
+        buffer.push_back(0);
+
+        append_attribute("compression", "compression", 1);
+        buffer.push_back(0);            // NO_COMPRESSION
+
+        for (const char* window : { "dataWindow", "displayWindow" }) {
+            append_attribute(window, "box2i", 16);
+            append(int32_t(0));
+            append(int32_t(0));
+            append(int32_t(width - 1));
+            append(int32_t(height - 1));
+        }
+
+        append_attribute("lineOrder", "lineOrder", 1);
+        buffer.push_back(0);            // INCREASING_Y
+
+        append_attribute("pixelAspectRatio", "float", 4);
+        append(1.0f);
+        append_attribute("screenWindowCenter", "v2f", 8);
+        append(0.0f);
+        append(0.0f);
+        append_attribute("screenWindowWidth", "float", 4);
+        append(1.0f);
+        buffer.push_back(0);            // End of header
+
+        // Uncompressed blocks hold one scanline each and have a fixed size
+        uint64_t block_size = 2 * sizeof(int32_t) + 3 * sizeof(float) * uint64_t(width);
+        uint64_t offset = buffer.size() + height * sizeof(uint64_t);
+        for (int y = 0; y < height; y++)
+            append(uint64_t(offset + y * block_size));
+    }
+
+    return write_all(fd, buffer.data(), buffer.size());
+}
+
+bool image_writer::write_rows(const float* rgb, int rows) {
+    size_t count = size_t(rows) * width * 3;
+    buffer.clear();
+
+    if (format == image_format::ppm) {
+        buffer.resize(count);
+        encode_gamma2(rgb, reinterpret_cast<unsigned char*>(buffer.data()), count);
+    } else if (format == image_format::pfm) {
+        const char* p = reinterpret_cast<const char*>(rgb);
+        buffer.assign(p, p + count * sizeof(float));
+    } else {
+        // Each block is the line number, the data size and then the B, G
+        // and R planes of the line
+        size_t block_floats = 2 + 3 * size_t(width);
+        buffer.resize(rows * block_floats * sizeof(float));
+        float* block = reinterpret_cast<float*>(buffer.data());
+
+        for (int row = 0; row < rows; row++, block += block_floats) {
+            int32_t header[2] = { rows_written + row, int32_t(3 * sizeof(float) * width) };
+            memcpy(block, header, sizeof(header));
+
+            const float* line = rgb + size_t(row) * width * 3;
+            for (int channel = 0; channel < 3; channel++) {
+                float* plane = block + 2 + (2 - channel) * width;
+                for (int i = 0; i < width; i++)
+                    plane[i] = line[i * 3 + channel];
+            }
+        }
+    }
+
+    rows_written += rows;
+    return write_all(fd, buffer.data(), buffer.size());
+}
+
+// Writes out one color per pixel of a width x height image, as returned by
+// pixel_value(i, j) with rows counted bottom-up, band_height rows at a time.
+template <typename PixelValue>
+bool write_pixels(image_writer& writer, int width, int height, int band_height, PixelValue pixel_value) {
+    if (!writer.write_header())
+        return false;
+
+    std::vector<float> band(size_t(band_height) * width * 3);
+
+    for (int band_start = 0; band_start < height; band_start += band_height) {
+        int rows = std::min(band_height, height - band_start);
+        float* out = band.data();
+
+        for (int row = band_start; row < band_start + rows; row++) {
+            int j = writer.bottom_up() ? row : height - 1 - row;
+            for (int i = 0; i < width; i++) {
+                color pixel_color = pixel_value(i, j);
+                *out++ = pixel_color.x();
+                *out++ = pixel_color.y();
+                *out++ = pixel_color.z();
+            }
+        }
+
+        if (!writer.write_rows(band.data(), rows))
+            return false;
+    }
+
+    return true;
+}
+
+// Writes out one color per pixel, as returned by pixel_value(accumulator),
+// one band of tile rows at a time.
+template <typename PixelValue>
+bool write_pixels(image_writer& writer, const framebuffer& image, PixelValue pixel_value) {
+    return write_pixels(writer, image.width, image.height, image.tile_size, [&](int i, int j) {
+        return pixel_value(image.at(i, j));
+    });
+}
+
+// Resolves the accumulated samples into linear pixels and writes them out
+bool write_image(image_writer& writer, const framebuffer& image) {
+    return write_pixels(writer, image, [](const pixel_accumulator& pixel) {
+        return pixel.mean();
+    });
+}
+
+// Writes the number of samples each pixel took, as a fraction of max_samples
+bool write_sample_counts(image_writer& writer, const framebuffer& image, int max_samples) {
+    return write_pixels(writer, image, [max_samples](const pixel_accumulator& pixel) {
+        auto fraction = pixel.samples / static_cast<float>(max_samples);
+        return color(fraction, fraction, fraction);
+    });
+}
+
+#endif
@@ -0,0 +1,241 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "flat_array.h"
+#include "hittable.h"
+#include "transform.h"
+
+#include <unordered_map>
+#include <vector>
+
+// One placement of a prototype. Rays are taken to the prototype's space by
+// to_object, so t is the same in both spaces and hits need no rescaling.
+struct instance {
+    affine to_world;
+    affine to_object;
+    int prototype;      // Index into instance_group::prototypes
+    int material;       // Index into instance_group::materials
+    int id;             // Order in which it was added, kept when the group is sorted
+};
+
+/**
+** Instances of a few shared prototypes, such as meshes with their own BVH,
+** each under an affine transform and with a material of its own. Only the
+** instances are stored per copy, by value and under one BVH, so a scene can
+** repeat an asset 10^5 times at little more than the size of a transform
+** each. The prototypes' own materials are replaced. build() has to be called
+** once everything is added.
+*/
+class instance_group : public hittable {
+    public:
+        instance_group() {}
+
+        int add_prototype(shared_ptr<hittable> object) {
+            prototypes.push_back(object);
+            return static_cast<int>(prototypes.size()) - 1;
+        }
+
+        // Index of m in materials, where it is added the first time
+        int add_material(const material* m) {
+            auto found = material_index.emplace(m, static_cast<int>(materials.size()));
+            if (found.second)
+                materials.push_back(m);
+            return found.first->second;
+        }
+
+        void add(int prototype, const affine& to_world, int material) {
+            int id = static_cast<int>(instances.size());
+            instances.push_back({ to_world, to_world.inverse(), prototype, material, id });
+        }
+
+        void build();
+
+        // Instance added as number id
+        const instance& get(int id) { return instances[slot(id)]; }
+
+        // Moves the instance added as number id. refit() has to be called
+        // once every instance that moves is moved.
+        void set_transform(int id, const affine& to_world);
+
+        // Refits the tree over the instances to their current transforms,
+        // keeping the prototypes and their trees as they are
+        void refit();
+
+        virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec)
+            const override;
+
+        virtual bool bounding_box(aabb& output_box) const override;
+
+        virtual bool occluded(const ray& r, real t_min, real t_max) const override;
+
+        virtual int hit_packet(const ray_packet& r, real t_min, preal& t_max, hit_record* rec, int active)
+            const override;
+
+        // Calls f on every array, the tree included, in a fixed order
+        template <typename F>
+        void for_each_array(F&& f) {
+            f(instances);
+            f(tree.nodes);
+        }
+
+        // Whether every instance refers to a prototype and a material of the
+        // group, the ids number the instances once each and the tree covers
+        // them, for a group read from a geometry cache
+        bool valid() const;
+
+    public:
+        std::vector<shared_ptr<hittable>> prototypes;
+        std::vector<const material*> materials;
+        flat_array<instance> instances;
+        bvh_tree tree;
+
+    private:
+        // Takes the record of a hit on the prototype of inst to world space
+        void to_world(const instance& inst, const ray& r, hit_record& rec) const {
+            rec.p = r.at(rec.t);
+            rec.normal = unit_vector(inst.to_object.apply_transposed(rec.normal));
+            rec.mat_ptr = materials[inst.material];
+            rec.light = -1;
+        }
+
+        int slot(int id) {
+            if (position.empty()) {
+                position.resize(instances.size());
+                for (size_t i = 0; i < instances.size(); i++)
+                    position[instances[i].id] = static_cast<int>(i);
+            }
+            return position[id];
+        }
+
+    private:
+        std::unordered_map<const material*, int> material_index;
+        std::vector<int> position;      // Of each instance id in instances
+        std::vector<aabb> prototype_boxes;
+};
+
+void instance_group::build() {
+    prototype_boxes.resize(prototypes.size());
+    for (size_t k = 0; k < prototypes.size(); k++)
+        prototypes[k]->bounding_box(prototype_boxes[k]);
+
+    std::vector<aabb> boxes(instances.size());
+    for (size_t i = 0; i < instances.size(); i++)
+        boxes[i] = instances[i].to_world.apply(prototype_boxes[instances[i].prototype]);
+
+    // Each instance costs a transform and a traversal of its own, keep
+    // leaves small
+    std::vector<int> order = tree.build(boxes, 2);
+
+    std::vector<instance> sorted;
+    sorted.reserve(order.size());
+    for (int i : order)
+        sorted.push_back(instances[i]);
+    instances.assign(std::move(sorted));
+}
+
+bool instance_group::valid() const {
+    std::vector<bool> seen(instances.size());
+    for (size_t i = 0; i < instances.size(); i++) {
+        const instance& inst = instances[i];
+        if (inst.prototype < 0 || size_t(inst.prototype) >= prototypes.size()
+            || inst.material < 0 || size_t(inst.material) >= materials.size()
+            || inst.id < 0 || size_t(inst.id) >= instances.size() || seen[inst.id])
+            return false;
+        seen[inst.id] = true;
+    }
+    return instances.size() <= size_t(std::numeric_limits<int>::max())
+           && tree.valid(static_cast<int>(instances.size()));
+}
+
+void instance_group::set_transform(int id, const affine& to_world) {
+    instance& inst = instances.mutable_data()[slot(id)];
+    inst.to_world = to_world;
+    inst.to_object = to_world.inverse();
+}
+
+void instance_group::refit() {
+    // Groups mapped from a cache were never built here
+    if (prototype_boxes.size() != prototypes.size()) {
+        prototype_boxes.resize(prototypes.size());
+        for (size_t k = 0; k < prototypes.size(); k++)
+            prototypes[k]->bounding_box(prototype_boxes[k]);
+    }
+
+    tree.refit([&](int i) {
+        return instances[i].to_world.apply(prototype_boxes[instances[i].prototype]);
+    });
+}
+
+bool instance_group::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+    int nearest = -1;
+
+    tree.traverse(r, t_min, t_max, [&](int first, int count, real& closest) {
+        bool hit_anything = false;
+        for (int i = first; i < first + count; i++) {
+            const instance& inst = instances[i];
+            ray local(inst.to_object.apply_point(r.orig), inst.to_object.apply_vector(r.dir));
+            if (prototypes[inst.prototype]->hit(local, t_min, closest, rec)) {
+                hit_anything = true;
+                closest = rec.t;
+                nearest = i;
+            }
+        }
+        return hit_anything;
+    });
+
+    if (nearest < 0)
+        return false;
+
+    to_world(instances[nearest], r, rec);
+    return true;
+}
+
+bool instance_group::occluded(const ray& r, real t_min, real t_max) const {
+    return tree.traverse_any(r, t_min, t_max, [&](int first, int count) {
+        for (int i = first; i < first + count; i++) {
+            const instance& inst = instances[i];
+            ray local(inst.to_object.apply_point(r.orig), inst.to_object.apply_vector(r.dir));
+            if (prototypes[inst.prototype]->occluded(local, t_min, t_max))
+                return true;
+        }
+        return false;
+    });
+}
+
+int instance_group::hit_packet(const ray_packet& r, real t_min, preal& t_max, hit_record* rec, int active) const {
+    int nearest[packet_width];
+
+    int hits = tree.traverse_packet(r, t_min, t_max, active, [&](int first, int count, int mask) {
+        int leaf_hits = 0;
+        for (int i = first; i < first + count; i++) {
+            const instance& inst = instances[i];
+            ray local[packet_width];
+            for (int k = 0; k < packet_width; k++)
+                if ((mask >> k) & 1)
+                    local[k] = ray(inst.to_object.apply_point(r.rays[k].orig), inst.to_object.apply_vector(r.rays[k].dir));
+
+            int lanes = prototypes[inst.prototype]->hit_packet(ray_packet(local, mask), t_min, t_max, rec, mask);
+            for (int k = 0; k < packet_width; k++)
+                if ((lanes >> k) & 1)
+                    nearest[k] = i;
+            leaf_hits |= lanes;
+        }
+        return leaf_hits;
+    });
+
+    for (int k = 0; k < packet_width; k++)
+        if ((hits >> k) & 1)
+            to_world(instances[nearest[k]], r.rays[k], rec[k]);
+
+    return hits;
+}
+
+bool instance_group::bounding_box(aabb& output_box) const {
+    output_box = tree.bounding_box();
+    return !tree.nodes.empty();
+}
+
+#endif
@@ -0,0 +1,336 @@
+#ifndef INTEGRATOR_H
+#define INTEGRATOR_H
+
+#include "rtweekend.h"
+#include "hittable.h"
+#include "material.h"
+#include "framebuffer.h"
+#include "light.h"
+#include "packet.h"
+#include "ray_stats.h"
+#include "sampler.h"
+
+#include <algorithm>
+#include <vector>
+
+// Bounce limits of a path. No path takes more than max_depth bounces, and
+// Russian roulette may end one once it has taken min_depth.
+struct path_limits {
+    int max_depth;
+    int min_depth;
+};
+
+// Russian roulette: after min_depth bounces a path goes on with a probability
+// equal to the largest component of its throughput, and survivors are
+// weighted up by its inverse, so dark paths end early without biasing the
+// image. Returns false when the path ends.
+inline bool survive_roulette(color& throughput, int bounces, const path_limits& limits, sample_stream& samples) {
+    if (bounces < limits.min_depth)
+        return true;
+    real p = fmax(throughput.x(), fmax(throughput.y(), throughput.z()));
+    if (p >= 1)
+        return true;
+    if (samples.roulette(bounces - 1) >= p)
+        return false;
+    throughput = throughput / p;
+    return true;
+}
+
+// A path between two bounces: the ray it goes on along, the fraction of the
+// light from there that reaches the camera, the light it has gathered so far
+// and the density the ray was scattered with when its material samples the
+// lights, else 0, for weighing the emission it hits.
+struct path_segment {
+    ray r;
+    color throughput;
+    color radiance;
+    real scatter_pdf;
+
+    path_segment() {}
+    path_segment(const ray& r) : r(r), throughput(1,1,1), radiance(0,0,0), scatter_pdf(0) {}
+};
+
+// Light leaving a hit towards the origin of r that comes straight from the
+// lights: the emission of the surface itself, and one light sample when the
+// material samples lights. Both that sample and the scattered ray may find
+// the same light, so each is weighed by the power heuristic against the
+// density of the other strategy.
+template <typename M>
+color direct_light(const M& mat, const ray& r, const hit_record& rec, real scatter_pdf, int bounce,
+                   const hittable& world, const scene_lights& lights, sample_stream& samples) {
+    color result = mat.emitted(rec);
+    if (scatter_pdf > 0 && rec.light >= 0)
+        result *= power_heuristic(scatter_pdf, lights.pdf(rec.light, r, rec));
+    if (!mat.samples_lights() || lights.empty())
+        return result;
+
+    samples.start_light(bounce);
+    real u = samples.next();
+    real v = samples.next();
+    real pick = samples.next();
+    light_sample s;
+    if (!lights.sample(rec.p, u, v, pick, s))
+        return result;
+
+    real pdf;
+    color f = mat.scattering(rec, s.direction, pdf);
+    if (pdf <= 0)
+        return result;
+
+    // Stop short of the light so that it does not shadow itself
+    thread_ray_stats.shadow();
+    if (world.occluded(ray(rec.p, s.direction), 0.001, s.distance * (1 - 1e-3)))
+        return result;
+    return result + f * s.emitted * (power_heuristic(s.pdf, pdf) / s.pdf);
+}
+
+// Adds the direct light at a hit of material mat to the path, scatters it
+// and plays Russian roulette. Returns false when the path ends there.
+template <typename M>
+bool shade_hit(const M& mat, path_segment& path, const hit_record& rec, int bounce, const hittable& world,
+               const scene_lights& lights, const path_limits& limits, sample_stream& samples) {
+    ray_stats& stats = thread_ray_stats;
+    path.radiance += path.throughput * direct_light(mat, path.r, rec, path.scatter_pdf, bounce, world, lights, samples);
+
+    ray scattered;
+    color attenuation;
+    samples.start_bounce(bounce);
+    if (!mat.scatter(path.r, rec, attenuation, scattered, samples)) {
+        if (rec.mat_ptr->emits())
+            stats.end_path(path_end::light, bounce);
+        else {
+            stats.reject_scatter(rec.mat_ptr->type());
+            stats.end_path(path_end::absorbed, bounce);
+        }
+        return false;
+    }
+
+    path.scatter_pdf = 0;
+    if (mat.samples_lights() && !lights.empty())
+        mat.scattering(rec, scattered.direction(), path.scatter_pdf);
+
+    path.throughput = path.throughput * attenuation;
+    if (!survive_roulette(path.throughput, bounce + 1, limits, samples)) {
+        stats.end_path(path_end::roulette, bounce + 1);
+        return false;
+    }
+    path.r = scattered;
+    return true;
+}
+
+// Reference integrator: follows one path depth first, from where it stands
+// after the given number of bounces.
+color ray_color(path_segment path, int bounces, const hittable& world, const scene_lights& lights,
+                const path_limits& limits, sample_stream& samples){
+    ray_stats& stats = thread_ray_stats;
+    for (; bounces < limits.max_depth; bounces++) {
+        hit_record rec;
+        stats.cast(bounces);
+        if (!world.hit(path.r,0.001,infinity,rec)) {
+            stats.end_path(path_end::miss, bounces);
+            return path.radiance + path.throughput * lights.sky(path.r);
+        }
+
+        if (!shade_hit(*rec.mat_ptr, path, rec, bounces, world, lights, limits, samples))
+            return path.radiance;
+    }
+
+    // Exceeded the ray bounce limit
+    stats.end_path(path_end::depth, bounces);
+    return path.radiance;
+}
+
+color ray_color(const ray& r, const hittable& world, const scene_lights& lights, const path_limits& limits, sample_stream& samples){
+    return ray_color(path_segment(r), 0, world, lights, limits, samples);
+}
+
+// Number of bounces traced as packets before every path goes on by itself.
+// Camera rays and first bounces are coherent enough to share box tests.
+const int packet_bounces = 2;
+
+// Traces the rays of the active lanes together, writing each lane's color to
+// result[lane]. Lane i draws its numbers from samples[i] only, the same ones
+// as ray_color, so the image matches the one traced ray by ray.
+void ray_color_packet(const ray* rays, int active, const hittable& world, const scene_lights& lights,
+                      const path_limits& limits, sample_stream* samples, color* result) {
+    path_segment lanes[packet_width];
+    for (int i = 0; i < packet_width; i++) {
+        lanes[i] = path_segment(rays[i]);
+        result[i] = color(0,0,0);
+    }
+
+    ray_stats& stats = thread_ray_stats;
+    int bounce = 0;
+    for (; bounce < packet_bounces && active; bounce++) {
+        // If exceeded the ray bounce limit
+        if (bounce >= limits.max_depth) {
+            for (int i = 0; i < packet_width; i++)
+                if ((active >> i) & 1) {
+                    result[i] = lanes[i].radiance;
+                    stats.end_path(path_end::depth, bounce);
+                }
+            return;
+        }
+
+        ray lane_rays[packet_width];
+        for (int i = 0; i < packet_width; i++)
+            lane_rays[i] = lanes[i].r;
+        ray_packet packet(lane_rays, active);
+        hit_record rec[packet_width];
+        preal t_max(infinity);
+        stats.cast(bounce, __builtin_popcount(active));
+        int hits = world.hit_packet(packet, 0.001, t_max, rec, active);
+
+        for (int i = 0; i < packet_width; i++) {
+            if (!((active >> i) & 1))
+                continue;
+
+            if ((hits >> i) & 1) {
+                if (shade_hit(*rec[i].mat_ptr, lanes[i], rec[i], bounce, world, lights, limits, samples[i]))
+                    continue;
+                result[i] = lanes[i].radiance;
+            } else {
+                result[i] = lanes[i].radiance + lanes[i].throughput * lights.sky(lanes[i].r);
+                stats.end_path(path_end::miss, bounce);
+            }
+            active &= ~(1 << i);
+        }
+    }
+
+    for (int i = 0; i < packet_width; i++)
+        if ((active >> i) & 1)
+            result[i] = ray_color(lanes[i], bounce, world, lights, limits, samples[i]);
+}
+
+// A path waiting in a wavefront queue.
+struct path_state {
+    path_segment path;
+    sample_stream samples;
+    pixel_accumulator* pixel;   // Pixel the path adds its color to
+};
+
+// Traces a batch of paths breadth first. Every bounce intersects the whole
+// queue, sorts the hits into one queue per material type and shades each
+// queue in a loop of direct scatter calls; the scattered rays make up the
+// queue of the next bounce. Each path keeps its own sample stream and draws
+// the same numbers from it as ray_color, so the image matches the recursive one
+// up to the order of the sums. Every path adds the light it gathered to its
+// pixel exactly once, when it escapes, is absorbed or runs out of bounces.
+class wavefront_integrator {
+    public:
+        // Paths traced by one call of trace()
+        static const int batch_size = 1 << 12;
+
+        wavefront_integrator(const hittable& world, const scene_lights& lights, const path_limits& limits, bool packets)
+            : world(&world), lights(&lights), limits(limits), packets(packets) {}
+
+        bool full() const { return static_cast<int>(paths.size()) >= batch_size; }
+
+        void add_path(const ray& r, const sample_stream& samples, pixel_accumulator* pixel) {
+            paths.push_back({path_segment(r), samples, pixel});
+        }
+
+        // Traces the queued paths to the end and empties the queue
+        void trace();
+
+    private:
+        void intersect(int bounce);
+
+        template <typename T>
+        void shade(const std::vector<int>& queue, int bounce);
+
+    private:
+        const hittable* world;
+        const scene_lights* lights;
+        path_limits limits;
+        bool packets;
+        std::vector<path_state> paths;
+        std::vector<path_state> next_paths;
+        std::vector<hit_record> hits;
+        std::vector<int> queues[material_type_count];
+};
+
+void wavefront_integrator::trace() {
+    for (int bounce = 0; bounce < limits.max_depth && !paths.empty(); bounce++) {
+        intersect(bounce);
+
+        next_paths.clear();
+        shade<lambertian>(queues[static_cast<int>(material_type::lambertian)], bounce);
+        shade<metal>(queues[static_cast<int>(material_type::metal)], bounce);
+        shade<dielectric>(queues[static_cast<int>(material_type::dielectric)], bounce);
+        shade<diffuse_light>(queues[static_cast<int>(material_type::diffuse_light)], bounce);
+        paths.swap(next_paths);
+    }
+
+    // Paths still going after max_depth bounces gather no more light
+    for (const path_state& path : paths) {
+        path.pixel->add(path.path.radiance);
+        thread_ray_stats.end_path(path_end::depth, limits.max_depth);
+    }
+    paths.clear();
+}
+
+// Finds the closest hit of every queued path. Paths that escape pick up the
+// sky color; the others are queued by the type of the material they hit.
+void wavefront_integrator::intersect(int bounce) {
+    int path_count = static_cast<int>(paths.size());
+    hits.resize(path_count);
+    for (auto& queue : queues)
+        queue.clear();
+
+    bool use_packets = packets && bounce < packet_bounces;
+    int step = use_packets ? packet_width : 1;
+    ray_stats& stats = thread_ray_stats;
+    stats.cast(bounce, path_count);
+
+    for (int first = 0; first < path_count; first += step) {
+        int lanes = std::min(step, path_count - first);
+        int hit_mask;
+
+        if (use_packets) {
+            ray lane_rays[packet_width];
+            hit_record rec[packet_width];
+            for (int k = 0; k < lanes; k++)
+                lane_rays[k] = paths[first + k].path.r;
+
+            int active = (1 << lanes) - 1;
+            ray_packet packet(lane_rays, active);
+            preal t_max(infinity);
+            hit_mask = world->hit_packet(packet, 0.001, t_max, rec, active);
+            for (int k = 0; k < lanes; k++)
+                if ((hit_mask >> k) & 1)
+                    hits[first + k] = rec[k];
+        } else {
+            hit_mask = world->hit(paths[first].path.r, 0.001, infinity, hits[first]) ? 1 : 0;
+        }
+
+        for (int k = 0; k < lanes; k++) {
+            int index = first + k;
+            if ((hit_mask >> k) & 1)
+                queues[static_cast<int>(hits[index].mat_ptr->type())].push_back(index);
+            else {
+                const path_segment& path = paths[index].path;
+                paths[index].pixel->add(path.radiance + path.throughput * lights->sky(path.r));
+                stats.end_path(path_end::miss, bounce);
+            }
+        }
+    }
+}
+
+// Shades every path of a queue at a material of type T: adds the direct
+// light, scatters and plays Russian roulette with the survivors. Every hit of
+// the queue is known to be a T, so it is shaded without the switches of
+// material.
+template <typename T>
+void wavefront_integrator::shade(const std::vector<int>& queue, int bounce) {
+    for (int index : queue) {
+        path_state path = paths[index];
+        const hit_record& rec = hits[index];
+        if (shade_hit(rec.mat_ptr->get<T>(), path.path, rec, bounce, *world, *lights, limits, path.samples))
+            next_paths.push_back(path);
+        else
+            path.pixel->add(path.path.radiance);
+    }
+}
+
+#endif
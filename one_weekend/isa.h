@@ -0,0 +1,63 @@
+#ifndef ISA_H
+#define ISA_H
+
+#include <cstring>
+
+// Instruction sets the SIMD code may use beyond SSE4.1. They follow the
+// compiler flags, or are defined by the render_<isa>.cpp file that builds
+// the renderer for one level: #pragma GCC target does not set __AVX2__ and
+// friends in C++.
+#if defined(__AVX2__) && !defined(SIMD_AVX2)
+#define SIMD_AVX2 1
+#endif
+#if defined(__FMA__) && !defined(SIMD_FMA)
+#define SIMD_FMA 1
+#endif
+
+// Levels the renderer is built for, from the oldest CPUs to the newest
+enum class isa_level { automatic, sse41, avx2, avx512 };
+
+inline const char* isa_name(isa_level isa) {
+    switch (isa) {
+        case isa_level::sse41:  return "sse4.1";
+        case isa_level::avx2:   return "avx2";
+        case isa_level::avx512: return "avx512";
+        default:                return "auto";
+    }
+}
+
+inline bool parse_isa(const char* name, isa_level& isa) {
+    if (!strcmp(name, "auto")) isa = isa_level::automatic;
+    else if (!strcmp(name, "sse4.1")) isa = isa_level::sse41;
+    else if (!strcmp(name, "avx2")) isa = isa_level::avx2;
+    else if (!strcmp(name, "avx512")) isa = isa_level::avx512;
+    else return false;
+    return true;
+}
+
+// Whether the CPU and the OS support a level. __builtin_cpu_supports reads
+// CPUID and checks that the OS saves the wider registers.
+inline bool isa_supported(isa_level isa) {
+    __builtin_cpu_init();
+    switch (isa) {
+        case isa_level::sse41:
+            return __builtin_cpu_supports("sse4.1");
+        case isa_level::avx2:
+            return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+        case isa_level::avx512:
+            return isa_supported(isa_level::avx2)
+                && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl")
+                && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512dq");
+        default:
+            return true;
+    }
+}
+
+// Newest level the CPU runs
+inline isa_level detect_isa() {
+    if (isa_supported(isa_level::avx512)) return isa_level::avx512;
+    if (isa_supported(isa_level::avx2)) return isa_level::avx2;
+    return isa_level::sse41;
+}
+
+#endif
@@ -0,0 +1,230 @@
+#ifndef LIGHT_H
+#define LIGHT_H
+
+#include "rtweekend.h"
+
+#include "color.h"
+#include "hittable.h"
+#include "material.h"
+#include "primitive_store.h"
+
+#include <algorithm>
+#include <vector>
+
+color sky_color(const ray& r) {
+    vec3 unit_direction = unit_vector(r.direction());
+    real t = 0.5*(unit_direction.y() + 1.0);
+    return (1.0-t)*color(1.0,1.0,1.0) + t*color(0.5,0.7,1.0);
+}
+
+// Two unit vectors that make an orthonormal basis with the unit vector n
+// (Duff et al. 2017)
+inline void orthonormal_basis(const vec3& n, vec3& b1, vec3& b2) {
+    real sign = n.z() >= 0 ? 1 : -1;
+    real a = -1 / (sign + n.z());
+    real b = n.x() * n.y() * a;
+    b1 = vec3(1 + sign * n.x() * n.x() * a, sign * b, -sign * n.x());
+    b2 = vec3(b, sign + n.y() * n.y() * a, -n.y());
+}
+
+// Weight of a sample drawn with density pdf against the other strategy,
+// which draws it with density other_pdf (Veach 1997)
+inline real power_heuristic(real pdf, real other_pdf) {
+    return pdf * pdf / (pdf * pdf + other_pdf * other_pdf);
+}
+
+// A point on a light as seen from a shading point: the unit direction to
+// it, its distance, the light it sends back along the direction and the
+// density with which the direction was picked, over solid angle
+struct light_sample {
+    vec3 direction;
+    real distance;
+    color emitted;
+    real pdf;
+};
+
+/**
+** The light sources of a scene: the sky, which is the gradient of the book
+** unless the scene sets a background color, and the spheres and triangles
+** of its primitive_store whose material is a diffuse_light. A light is
+** picked in proportion to its power. Then a sphere is sampled uniformly over
+** the cone of directions it fills and a triangle uniformly over its area, so
+** the density of a direction is known both when it is sampled and when a
+** scattered ray happens to hit the light, as multiple importance sampling
+** needs. Emissive OBJ meshes and instances are not in the list; they only
+** shine on what scatters into them.
+*/
+class scene_lights {
+    public:
+        scene_lights() {}
+
+        // Lists the emissive spheres and triangles of store and writes their
+        // indices to its sphere_light and triangle_light
+        void collect(primitive_store& store);
+
+        bool empty() const { return lights.empty(); }
+
+        color sky(const ray& r) const { return has_background ? background : sky_color(r); }
+
+        // Picks a light with pick and a point on it with (u, v), as seen from
+        // p. Returns false when p cannot see the front of that light.
+        bool sample(const point3& p, real u, real v, real pick, light_sample& s) const;
+
+        // Density with which sample() picks the direction of r, which hits
+        // light k at rec
+        real pdf(int k, const ray& r, const hit_record& rec) const;
+
+    public:
+        bool has_background = false;
+        color background;
+
+    private:
+        struct area_light {
+            primitive_kind kind;
+            int index;          // In the spheres or triangles of the store
+            color emit;
+            real area;          // Of a triangle
+            real probability;   // Of being picked
+        };
+
+        // Cosine of the half angle of the cone of directions from p that
+        // hit sphere i, as 1 - cos; false when p is inside the sphere
+        bool cone(const point3& p, int i, vec3& axis, real& distance, real& one_minus_cos) const;
+
+    private:
+        const primitive_store* store = nullptr;
+        std::vector<area_light> lights;
+        std::vector<real> cdf;      // Probability of picking one of the lights up to each
+};
+
+void scene_lights::collect(primitive_store& primitives) {
+    store = &primitives;
+    lights.clear();
+    primitives.sphere_light.assign(primitives.spheres.size(), -1);
+    primitives.triangle_light.assign(primitives.triangles.size(), -1);
+
+    auto emit = [&](int material) {
+        const class material* m = primitives.materials[material];
+        return m->emits() ? m->get<diffuse_light>().emit : color(0,0,0);
+    };
+
+    std::vector<real> power;
+    const sphere_soa& spheres = primitives.spheres;
+    for (int i = 0; i < spheres.size(); i++) {
+        color e = emit(spheres.material[i]);
+        real area = 4 * pi * spheres.radius[i] * spheres.radius[i];
+        if (luminance(e) <= 0 || area <= 0)
+            continue;
+        primitives.sphere_light[i] = static_cast<int>(lights.size());
+        lights.push_back({ primitive_kind::sphere, i, e, area, 0 });
+        power.push_back(luminance(e) * area);
+    }
+
+    const triangle_soa& triangles = primitives.triangles;
+    for (int i = 0; i < triangles.size(); i++) {
+        color e = emit(primitives.triangle_material[i]);
+        vec3 e1(triangles.e1x[i], triangles.e1y[i], triangles.e1z[i]);
+        vec3 e2(triangles.e2x[i], triangles.e2y[i], triangles.e2z[i]);
+        real area = cross(e1, e2).length() / 2;
+        if (luminance(e) <= 0 || area <= 0)
+            continue;
+        primitives.triangle_light[i] = static_cast<int>(lights.size());
+        lights.push_back({ primitive_kind::triangle, i, e, area, 0 });
+        power.push_back(luminance(e) * area);
+    }
+
+    double total = 0;
+    for (real w : power)
+        total += w;
+    cdf.resize(lights.size());
+    double sum = 0;
+    for (size_t k = 0; k < lights.size(); k++) {
+        lights[k].probability = power[k] / total;
+        sum += power[k];
+        cdf[k] = sum / total;
+    }
+}
+
+bool scene_lights::cone(const point3& p, int i, vec3& axis, real& distance, real& one_minus_cos) const {
+    const sphere_soa& spheres = store->spheres;
+    axis = point3(spheres.cx[i], spheres.cy[i], spheres.cz[i]) - p;
+    real distance_squared = axis.length_squared();
+    real radius_squared = spheres.radius[i] * spheres.radius[i];
+    if (distance_squared <= radius_squared)
+        return false;
+
+    // 1 - cos from sin^2, which keeps its digits for small, far lights
+    real sin_squared = radius_squared / distance_squared;
+    one_minus_cos = sin_squared / (1 + sqrt(1 - sin_squared));
+    distance = sqrt(distance_squared);
+    axis = axis / distance;
+    return true;
+}
+
+bool scene_lights::sample(const point3& p, real u, real v, real pick, light_sample& s) const {
+    int k = static_cast<int>(std::upper_bound(cdf.begin(), cdf.end(), pick) - cdf.begin());
+    const area_light& light = lights[std::min(k, static_cast<int>(lights.size()) - 1)];
+
+    if (light.kind == primitive_kind::sphere) {
+        vec3 axis;
+        real distance, one_minus_cos;
+        if (!cone(p, light.index, axis, distance, one_minus_cos))
+            return false;
+
+        // Uniform direction in the cone, and where it first meets the sphere
+        real d = u * one_minus_cos;
+        real cos_theta = 1 - d;
+        real sin_theta = sqrt(fmax(0, d * (2 - d)));
+        real phi = 2 * pi * v;
+        vec3 b1, b2;
+        orthonormal_basis(axis, b1, b2);
+        s.direction = (cos(phi) * sin_theta) * b1 + (sin(phi) * sin_theta) * b2 + cos_theta * axis;
+
+        real radius = store->spheres.radius[light.index];
+        real chord = radius * radius - distance * distance * sin_theta * sin_theta;
+        s.distance = distance * cos_theta - sqrt(fmax(0, chord));
+        s.pdf = light.probability / (2 * pi * one_minus_cos);
+    } else {
+        const triangle_soa& triangles = store->triangles;
+        int i = light.index;
+        real su = sqrt(u);
+        point3 q = point3(triangles.ax[i], triangles.ay[i], triangles.az[i])
+                 + (su * (1 - v)) * vec3(triangles.e1x[i], triangles.e1y[i], triangles.e1z[i])
+                 + (su * v) * vec3(triangles.e2x[i], triangles.e2y[i], triangles.e2z[i]);
+        vec3 to_light = q - p;
+        real distance_squared = to_light.length_squared();
+        s.distance = sqrt(distance_squared);
+        s.direction = to_light / s.distance;
+
+        // Only the front face shines
+        real cos_light = -dot(vec3(triangles.nx[i], triangles.ny[i], triangles.nz[i]), s.direction);
+        if (cos_light <= 0)
+            return false;
+        s.pdf = light.probability * distance_squared / (light.area * cos_light);
+    }
+
+    s.emitted = light.emit;
+    return true;
+}
+
+real scene_lights::pdf(int k, const ray& r, const hit_record& rec) const {
+    const area_light& light = lights[k];
+    if (light.kind == primitive_kind::sphere) {
+        vec3 axis;
+        real distance, one_minus_cos;
+        if (!cone(r.origin(), light.index, axis, distance, one_minus_cos))
+            return 0;
+        return light.probability / (2 * pi * one_minus_cos);
+    }
+
+    const triangle_soa& triangles = store->triangles;
+    int i = light.index;
+    real length = r.direction().length();
+    real distance = rec.t * length;
+    real cos_light = fabs(dot(vec3(triangles.nx[i], triangles.ny[i], triangles.nz[i]), r.direction())) / length;
+    if (cos_light <= 0)
+        return 0;
+    return light.probability * distance * distance / (light.area * cos_light);
+}
+
+#endif
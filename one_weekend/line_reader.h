@@ -0,0 +1,57 @@
+#ifndef LINE_READER_H
+#define LINE_READER_H
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+// Calls parse_line(char* line) on every line of a text file, in order, until
+// it returns false. The file is read in large blocks and the lines are
+// handed out in place, nul-terminated and without the newline, so parsers
+// allocate nothing per line. Returns false if the file cannot be read or a
+// line was rejected.
+template <typename LineParser>
+bool read_lines(const char* path, LineParser&& parse_line) {
+    FILE* file = fopen(path, "rb");
+    if (!file)
+        return false;
+
+    std::vector<char> buffer(1 << 20);
+    size_t filled = 0;
+    bool ok = true;
+
+    while (ok) {
+        // One byte is kept free to terminate the last line
+        size_t n = fread(buffer.data() + filled, 1, buffer.size() - filled - 1, file);
+        filled += n;
+        bool at_end = n == 0;
+        if (at_end)
+            buffer[filled++] = '\n';
+
+        char* line = buffer.data();
+        char* end = line + filled;
+        while (ok) {
+            char* newline = static_cast<char*>(memchr(line, '\n', end - line));
+            if (!newline)
+                break;
+            *newline = '\0';
+            ok = parse_line(line);
+            line = newline + 1;
+        }
+
+        if (at_end)
+            break;
+
+        // Keep the partial line for the next block, growing the buffer for
+        // lines longer than the whole of it
+        filled = end - line;
+        memmove(buffer.data(), line, filled);
+        if (filled == buffer.size() - 1)
+            buffer.resize(2 * buffer.size());
+    }
+
+    fclose(file);
+    return ok;
+}
+
+#endif
@@ -3,85 +3,231 @@
 
 #include "rtweekend.h"
 #include "hittable.h"
+#include "sampler.h"
+
+#include <deque>
+#include <utility>
 
 struct hit_record;
 
-class material {
-    public:
-        virtual bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered)
-            const = 0;
+// Materials are a closed set of types, stored by value in a tagged union and
+// dispatched with a switch, so that scatter inlines. Integrators can also
+// group hits by type and shade each group with direct calls.
+//
+// Besides scatter, every type tells whether the integrator should sample
+// the lights at its hits, the light it sends back towards the origin of a
+// ray per unit of light arriving from a direction with the density scatter
+// picks that direction with, and the light it emits itself.
+enum class material_type { lambertian, metal, dielectric, diffuse_light };
+const int material_type_count = 4;
+
+struct lambertian {
+    static const material_type type = material_type::lambertian;
+
+    lambertian(const color& a) : albedo(a) {}
+
+    bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered, sample_stream& samples) const {
+        real u = samples.next();
+        real v = samples.next();
+        vec3 scatter_direction = rec.normal + square_to_sphere(u, v);
+
+        // Degenerate scatter direction
+        if (scatter_direction.near_zero())
+            scatter_direction = rec.normal;
+
+        scattered = ray(rec.p, scatter_direction);
+        attenuation = albedo;
+        return true;
+    }
+
+    static bool samples_lights() { return true; }
+
+    // Directions are cosine distributed about the normal
+    color scattering(const hit_record& rec, const vec3& direction, real& pdf) const {
+        pdf = fmax(dot(rec.normal, unit_vector(direction)), 0) / pi;
+        return albedo * pdf;
+    }
+
+    color emitted(const hit_record&) const { return color(0,0,0); }
+
+    color albedo;
 };
 
-class lambertian : public material {
-    public:
-        lambertian(const color& a) : albedo(a) {}
+struct metal {
+    static const material_type type = material_type::metal;
 
-        virtual bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override {
-            vec3 scatter_direction = rec.normal + random_unit_vector();
+    metal(const color& a, real r) : albedo(a), roughness(r<1 ? r : 1) {}
 
-            // Degenerate scatter direction
-            if (scatter_direction.near_zero())
-                scatter_direction = rec.normal;
+    bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered, sample_stream& samples) const {
+        real u = samples.next();
+        real v = samples.next();
+        real w = samples.next();
+        vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
+        scattered = ray(rec.p, reflected + roughness * cube_to_ball(u, v, w));
+        attenuation = albedo;
+        return (dot(scattered.direction(), rec.normal) > 0);
+    }
 
-            scattered = ray(rec.p, scatter_direction);
-            attenuation = albedo;
-            return true;
-        }
-    
-    public:
-        color albedo;
+    // The fuzzy lobe has no density that light samples can be weighed against
+    static bool samples_lights() { return false; }
+
+    color scattering(const hit_record&, const vec3&, real& pdf) const {
+        pdf = 0;
+        return color(0,0,0);
+    }
+
+    color emitted(const hit_record&) const { return color(0,0,0); }
+
+    color albedo;
+    real roughness;
 };
 
-class metal : public material {
-    public:
-        metal(const color& a, double r) : albedo(a), roughness(r<1 ? r : 1) {}
+struct dielectric {
+    static const material_type type = material_type::dielectric;
 
-        virtual bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override {
-            vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
-            scattered = ray(rec.p, reflected + roughness * random_in_unit_sphere());
-            attenuation = albedo;
-            return (dot(scattered.direction(), rec.normal) > 0);
-        }
-    
-    public:
-        color albedo;
-        double roughness;
+    dielectric(real index_of_refraction) : ir(index_of_refraction) {}
+
+    bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered, sample_stream& samples) const {
+        attenuation = color(1.0, 1.0, 1.0);
+        real refraction_ratio = rec.front_face ? (1.0/ir) : ir;
+
+        vec3 unit_direction = unit_vector(r_in.direction());
+        real cos_theta = fmin(dot(-unit_direction, rec.normal), 1.0);
+        real sin_theta = sqrt(1.0 - cos_theta*cos_theta);
+
+        bool cannot_refract = refraction_ratio * sin_theta > 1.0;
+        vec3 direction;
+
+        if (cannot_refract || reflectance(cos_theta, refraction_ratio) > samples.next())
+            direction = reflect(unit_direction, rec.normal);
+        else
+            direction = refract(unit_direction, rec.normal, refraction_ratio);
+
+        scattered = ray(rec.p, direction);
+        return true;
+    }
+
+    static real reflectance(real cosine, real ref_idx) {
+        // Use Schlick's approximation for reflectance.
+        real r0 = (1-ref_idx) / (1+ref_idx);
+        r0 = r0*r0;
+        return r0 + (1-r0)*pow((1 - cosine),5);
+    }
+
+    static bool samples_lights() { return false; }
+
+    color scattering(const hit_record&, const vec3&, real& pdf) const {
+        pdf = 0;
+        return color(0,0,0);
+    }
+
+    color emitted(const hit_record&) const { return color(0,0,0); }
+
+    real ir;
 };
 
-class dielectric : public material {
-    public:
-        dielectric(double index_of_refraction) : ir(index_of_refraction) {}
+// Emits emit from its front face, the side the normal of a sphere or
+// triangle points to, and absorbs everything that hits it
+struct diffuse_light {
+    static const material_type type = material_type::diffuse_light;
 
-        virtual bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override {
-            attenuation = color(1.0, 1.0, 1.0);
-            double refraction_ratio = rec.front_face ? (1.0/ir) : ir;
+    diffuse_light(const color& e) : emit(e) {}
 
-            vec3 unit_direction = unit_vector(r_in.direction());
-            double cos_theta = fmin(dot(-unit_direction, rec.normal), 1.0);
-            double sin_theta = sqrt(1.0 - cos_theta*cos_theta);
+    bool scatter(const ray&, const hit_record&, color&, ray&, sample_stream&) const { return false; }
 
-            bool cannot_refract = refraction_ratio * sin_theta > 1.0;
-            vec3 direction;
+    static bool samples_lights() { return false; }
 
-            if (cannot_refract || reflectance(cos_theta, refraction_ratio) > random_double())
-                direction = reflect(unit_direction, rec.normal);
-            else
-                direction = refract(unit_direction, rec.normal, refraction_ratio);
+    color scattering(const hit_record&, const vec3&, real& pdf) const {
+        pdf = 0;
+        return color(0,0,0);
+    }
 
-            scattered = ray(rec.p, direction);
-            return true;
-        }
+    color emitted(const hit_record& rec) const { return rec.front_face ? emit : color(0,0,0); }
 
+    color emit;
+};
+
+// Any one of the material types, by value
+class material {
     public:
-        double ir;
-    
+        material(const lambertian& m) : kind(material_type::lambertian), as_lambertian(m) {}
+        material(const metal& m) : kind(material_type::metal), as_metal(m) {}
+        material(const dielectric& m) : kind(material_type::dielectric), as_dielectric(m) {}
+        material(const diffuse_light& m) : kind(material_type::diffuse_light), as_diffuse_light(m) {}
+
+        material_type type() const { return kind; }
+
+        // The material as a T, which has to be its type
+        template <typename T>
+        const T& get() const;
+
+        // Fraction of the light the surface passes on, for the denoiser's
+        // albedo feature. Glass passes all of it, and lights are taken as
+        // white so that their color is kept as lighting.
+        color albedo() const {
+            switch (kind) {
+                case material_type::lambertian: return as_lambertian.albedo;
+                case material_type::metal:      return as_metal.albedo;
+                default:                        return color(1, 1, 1);
+            }
+        }
+
+        bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered, sample_stream& samples) const {
+            switch (kind) {
+                case material_type::lambertian: return as_lambertian.scatter(r_in, rec, attenuation, scattered, samples);
+                case material_type::metal:      return as_metal.scatter(r_in, rec, attenuation, scattered, samples);
+                case material_type::dielectric: return as_dielectric.scatter(r_in, rec, attenuation, scattered, samples);
+                default:                        return as_diffuse_light.scatter(r_in, rec, attenuation, scattered, samples);
+            }
+        }
+
+        bool samples_lights() const { return kind == material_type::lambertian; }
+
+        color scattering(const hit_record& rec, const vec3& direction, real& pdf) const {
+            if (kind == material_type::lambertian)
+                return as_lambertian.scattering(rec, direction, pdf);
+            pdf = 0;
+            return color(0,0,0);
+        }
+
+        color emitted(const hit_record& rec) const {
+            if (kind == material_type::diffuse_light)
+                return as_diffuse_light.emitted(rec);
+            return color(0,0,0);
+        }
+
+        bool emits() const { return kind == material_type::diffuse_light; }
+
     private:
-        static double reflectance(double cosine, double ref_idx) {
-            // Use Schlick's approximation for reflectance.
-            double r0 = (1-ref_idx) / (1+ref_idx);
-            r0 = r0*r0;
-            return r0 + (1-r0)*pow((1 - cosine),5);
+        material_type kind;
+        union {
+            lambertian as_lambertian;
+            metal as_metal;
+            dielectric as_dielectric;
+            diffuse_light as_diffuse_light;
+        };
+};
+
+template <> inline const lambertian& material::get<lambertian>() const { return as_lambertian; }
+template <> inline const metal& material::get<metal>() const { return as_metal; }
+template <> inline const dielectric& material::get<dielectric>() const { return as_dielectric; }
+template <> inline const diffuse_light& material::get<diffuse_light>() const { return as_diffuse_light; }
+
+// Owns the materials of a scene, by value. Objects and hit records refer to
+// them through plain pointers, which stay valid as long as the table lives:
+// a deque does not move its elements when it grows.
+class material_table {
+    public:
+        template <typename T, typename... Args>
+        const material* add(Args&&... args) {
+            materials.emplace_back(T(std::forward<Args>(args)...));
+            return &materials.back();
         }
+
+        size_t size() const { return materials.size(); }
+
+    private:
+        std::deque<material> materials;
 };
 
-#endif
\ No newline at end of file
+#endif
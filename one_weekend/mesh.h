@@ -4,22 +4,34 @@
 #include "hittable.h"
 #include "vec3.h"
 
+// A ray is taken to miss a triangle when the cosine of its angle with the
+// plane's normal is smaller than this, so that the intersection is never
+// solved for a ray that runs along the plane. The test is on an angle, so it
+// holds the same for triangles of any size and ray directions of any length,
+// which instances scale along with their mesh.
+const real grazing_cosine = 1e-5;
+
 class mesh : public hittable {
     public:
         mesh() {}
-        mesh(point3 point_A, point3 point_B, point3  point_C, shared_ptr<material> m) : A(point_A), B(point_B), C(point_C), mat_ptr(m) {};
+        mesh(point3 point_A, point3 point_B, point3  point_C, const material* m) : A(point_A), B(point_B), C(point_C), mat_ptr(m) {};
+
+        virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec)
+            const override;
+
+        virtual bool bounding_box(aabb& output_box) const override;
 
-        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec)
+        virtual int hit_packet(const ray_packet& r, real t_min, preal& t_max, hit_record* rec, int active)
             const override;
 
     public:
         point3 A;
         point3 B;
         point3 C;
-        shared_ptr<material> mat_ptr;
+        const material* mat_ptr;
 };
 
-bool mesh::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+bool mesh::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
     vec3 B_A = B - A;
     vec3 C_A = C - A;
     vec3 _r = - r.direction();
@@ -32,21 +44,24 @@ bool mesh::hit(const ray& r, double t_min, double t_max, hit_record& rec) const
     // Cramer's rule for matrix inversion
     // D = det(A)
     // [B_A, C_A, _r, B_A, C_A]
-    double D  = det(B_A, C_A, _r);
-    /*B_A.x() * C_A.y() *  _r.z()
+    real D  = det(B_A,C_A,_r);
+    /*        B_A.x() * C_A.y() *  _r.z()
               + C_A.x() *  _r.y() * B_A.z()
               +  _r.x() * B_A.y() * C_A.z()
               - B_A.z() * C_A.y() *  _r.x()
               - C_A.z() *  _r.y() * B_A.x()
               -  _r.z() * B_A.y() * C_A.x();*/
 
-    // If ill-conditioned no solution
-    if (D <= 1e-3 && D >= -1e-3)
+    // D is minus the dot product of the direction with the triangle's
+    // normal scaled by twice its area, so it is compared with both lengths.
+    // If ill-conditioned no solution.
+    vec3 N = cross(B_A,C_A);
+    if (D * D <= grazing_cosine * grazing_cosine * N.length_squared() * r.direction().length_squared())
         return false;
 
     // Dx
     // [O_A, C_A, _r, O_A, C_A]
-    double D1 = det(O_A, C_A, _r);
+    real D1 = det(O_A,C_A,_r);
     /*O_A.x() * C_A.y() *  _r.z()
               + C_A.x() *  _r.y() * O_A.z()
               +  _r.x() * O_A.y() * C_A.z()
@@ -56,7 +71,7 @@ bool mesh::hit(const ray& r, double t_min, double t_max, hit_record& rec) const
 
     // Dy
     // [B_A, O_A, _r, B_A, O_A]
-    double D2 = det(B_A, O_A, _r);
+    real D2 = det(B_A,O_A,_r);
     /*B_A.x() * O_A.y() *  _r.z()
               + O_A.x() *  _r.y() * B_A.z()
               +  _r.x() * B_A.y() * O_A.z()
@@ -66,7 +81,7 @@ bool mesh::hit(const ray& r, double t_min, double t_max, hit_record& rec) const
 
     // Dz
     // [B_A, C_A, O_A, B_A, C_A]
-    double D3 = det(B_A, C_A, O_A);
+    real D3 = det(B_A,C_A,O_A);
     /*B_A.x() * C_A.y() * O_A.z()
               + C_A.x() * O_A.y() * B_A.z()
               + O_A.x() * B_A.y() * C_A.z()
@@ -75,23 +90,81 @@ bool mesh::hit(const ray& r, double t_min, double t_max, hit_record& rec) const
               - O_A.z() * B_A.y() * C_A.x();*/
 
     // Compute l1, l2 and t
-    double l1 = D1 / D;
-    double l2 = D2 / D;
-    double  t = D3 / D;
+    real l1 = D1 / D;
+    real l2 = D2 / D;
+    real  t = D3 / D;
 
     if (l1 >= 0 && l2 >= 0 && l1+l2 <= 1 && t >= t_min && t <= t_max) {
         rec.t = t;
         rec.p = r.origin() + t * r.direction();
 
-        vec3 outward_normal = unit_vector(cross(B_A,C_A));
+        vec3 outward_normal = unit_vector(N);
         rec.set_face_normal(r, outward_normal);
 
         rec.mat_ptr = mat_ptr;
-        
+        rec.light = -1;
+
         return true;
     }
 
     return false;
 }
 
+int mesh::hit_packet(const ray_packet& r, real t_min, preal& t_max, hit_record* rec, int active) const {
+    vec3 B_A = B - A;
+    vec3 C_A = C - A;
+    pvec3 _r = - r.dir;
+
+    pvec3 O_A = r.orig - pvec3(A);
+
+    // Same Cramer's rule as hit(), for every lane at once. The cross products
+    // with the broadcast edges are shared between the determinants.
+    pvec3 C_A_x_r = cross(pvec3(C_A), _r);
+    preal D  = dot(pvec3(B_A), C_A_x_r);
+    preal D1 = dot(O_A, C_A_x_r);
+    preal D2 = dot(pvec3(B_A), cross(O_A, _r));
+    preal D3 = dot(pvec3(B_A), cross(pvec3(C_A), O_A));
+
+    // If ill-conditioned no solution, see hit()
+    vec3 N = cross(B_A,C_A);
+    preal grazing = preal(grazing_cosine * grazing_cosine * N.length_squared()) * dot(r.dir, r.dir);
+    preal valid = preal::lane_mask(active) & (D * D > grazing);
+    if (!movemask(valid))
+        return 0;
+
+    preal l1 = D1 / D;
+    preal l2 = D2 / D;
+    preal  t = D3 / D;
+
+    valid = valid & (l1 >= preal(0.0f)) & (l2 >= preal(0.0f)) & (l1 + l2 <= preal(1.0f))
+                  & (t >= preal(t_min)) & (t <= t_max);
+
+    int hits = movemask(valid);
+    if (!hits)
+        return 0;
+    t_max = select(valid, t, t_max);
+
+    vec3 outward_normal = unit_vector(N);
+    alignas(32) real t_lanes[packet_width];
+    t.store(t_lanes);
+    for (int i = 0; i < packet_width; i++) {
+        if (!((hits >> i) & 1))
+            continue;
+
+        rec[i].t = t_lanes[i];
+        rec[i].p = r.rays[i].origin() + t_lanes[i] * r.rays[i].direction();
+        rec[i].set_face_normal(r.rays[i], outward_normal);
+
+        rec[i].mat_ptr = mat_ptr;
+        rec[i].light = -1;
+    }
+
+    return hits;
+}
+
+bool mesh::bounding_box(aabb& output_box) const {
+    output_box = padded(surrounding_box(surrounding_box(aabb(A, A), B), C));
+    return true;
+}
+
 #endif
\ No newline at end of file
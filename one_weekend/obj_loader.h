@@ -0,0 +1,83 @@
+#ifndef OBJ_LOADER_H
+#define OBJ_LOADER_H
+
+#include "rtweekend.h"
+#include "line_reader.h"
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+// Parses one line of an OBJ file, see load_obj. face is scratch space reused
+// between lines.
+inline bool parse_obj_line(char* line, std::vector<point3>& vertices, std::vector<int>& indices, std::vector<int>& face) {
+    while (isspace(static_cast<unsigned char>(*line)))
+        line++;
+
+    if (line[0] == 'v' && isspace(static_cast<unsigned char>(line[1]))) {
+        char* p = line + 1;
+        real e[3];
+        for (int k = 0; k < 3; k++) {
+            char* next;
+            e[k] = strtod(p, &next);
+            if (next == p)
+                return false;
+            p = next;
+        }
+        vertices.push_back(point3(e[0], e[1], e[2]));
+    } else if (line[0] == 'f' && isspace(static_cast<unsigned char>(line[1]))) {
+        char* p = line + 1;
+        face.clear();
+        while (true) {
+            while (isspace(static_cast<unsigned char>(*p)))
+                p++;
+            if (*p == '\0')
+                break;
+
+            char* next;
+            long index = strtol(p, &next, 10);
+            if (next == p || index == 0)
+                return false;
+
+            // 1-based, or relative to the last vertex when negative
+            face.push_back(static_cast<int>(index > 0 ? index - 1 : long(vertices.size()) + index));
+
+            // Skip the texture and normal indices of "v/vt/vn"
+            p = next;
+            while (*p != '\0' && !isspace(static_cast<unsigned char>(*p)))
+                p++;
+        }
+        if (face.size() < 3)
+            return false;
+
+        // Polygons are split into a fan of triangles around the first vertex
+        for (size_t k = 2; k < face.size(); k++) {
+            indices.push_back(face[0]);
+            indices.push_back(face[k-1]);
+            indices.push_back(face[k]);
+        }
+    }
+
+    // Everything else (normals, texture coordinates, groups, materials) is ignored
+    return true;
+}
+
+// Streaming Wavefront OBJ reader for vertex positions and faces, parsed in
+// place by read_lines. Returns false if the file cannot be read, is
+// malformed or references a vertex that does not exist.
+bool load_obj(const char* path, std::vector<point3>& vertices, std::vector<int>& indices) {
+    std::vector<int> face;
+    bool ok = read_lines(path, [&](char* line) {
+        return parse_obj_line(line, vertices, indices, face);
+    });
+
+    for (int index : indices)
+        if (index < 0 || index >= static_cast<int>(vertices.size()))
+            return false;
+
+    return ok;
+}
+
+#endif
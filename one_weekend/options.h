@@ -0,0 +1,236 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include "image_format.h"
+#include "isa.h"
+#include "sampler_type.h"
+
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+struct render_options {
+    unsigned int thread_count = 0;  // 0: one per hardware thread
+    int tile_size = 32;
+    image_format format = image_format::ppm;
+    const char* output_path = nullptr;  // nullptr: standard output
+    const char* scene_path = nullptr;   // Scene file, nullptr: the generated scene
+    int grid = 11;                      // Grid size of the generated scene
+    const char* scene_output = nullptr; // Write the scene there instead of rendering
+    const char* obj_path = nullptr;     // Wavefront OBJ mesh added to the scene
+    const char* cache_dir = nullptr;    // Directory of geometry caches, nullptr: no cache
+    bool packets = true;                // Trace camera rays and first bounces as packets
+    bool wavefront = true;              // Trace paths in queues, bounce by bounce
+    int min_depth = 3;                  // Bounces before Russian roulette may end a path
+    double target_error = 0;            // 0: fixed samples per pixel, otherwise adaptive
+    int min_samples = 16;               // Adaptive samples per pixel and per round
+    int max_samples = 256;
+    const char* samples_output = nullptr;   // Image of the samples each pixel took
+    int samples_per_pixel = 0;          // Fixed samples per pixel, 0: from the scene
+    int pass_samples = 0;               // Samples per pixel added by each pass, 0: one pass
+    const char* checkpoint_path = nullptr;  // Accumulator saved after every pass
+    bool resume = false;                // Start from the checkpoint instead of an empty image
+    isa_level isa = isa_level::automatic;   // Instruction set of the render kernels
+    const char* stats_path = nullptr;   // Ray statistics written there as JSON
+    int frames = 1;                     // Frames of the sequence, each to its own output
+    const char* coordinator_address = nullptr;  // Deal tiles to workers connecting there
+    const char* worker_address = nullptr;       // Render tiles for the coordinator there
+    int spawn_workers = 0;              // Worker processes the coordinator starts itself
+    bool denoise = false;               // Filter the image with its first-hit features
+    sampler_type sampler = sampler_type::sobol;     // Numbers of the pixel, lens and bounce dimensions
+};
+
+// Finds the frame number field, %d or %0Nd, in a path pattern. Returns false
+// when there is none, or more than one %.
+inline bool find_frame_field(const char* pattern, size_t& start, size_t& length) {
+    const char* p = strchr(pattern, '%');
+    if (!p)
+        return false;
+    const char* q = p + 1;
+    while (isdigit(static_cast<unsigned char>(*q)))
+        q++;
+    if (*q != 'd' || strchr(q, '%'))
+        return false;
+    start = p - pattern;
+    length = q + 1 - p;
+    return true;
+}
+
+// The pattern with its frame number field replaced by frame, or the pattern
+// itself if it has none
+inline std::string frame_path(const char* pattern, int frame) {
+    size_t start, length;
+    if (!find_frame_field(pattern, start, length))
+        return pattern;
+    char number[32];
+    snprintf(number, sizeof(number), std::string(pattern + start, length).c_str(), frame);
+    return std::string(pattern, start) + number + (pattern + start + length);
+}
+
+// Reads a whole decimal string into n. Returns false when it is negative,
+// too large for an int, or not a number.
+inline bool parse_count(const char* s, unsigned int& n) {
+    char* end;
+    errno = 0;
+    long value = strtol(s, &end, 10);
+    if (end == s || *end || errno || value < 0 || value > INT_MAX)
+        return false;
+    n = static_cast<unsigned int>(value);
+    return true;
+}
+
+inline void print_usage(const char* program) {
+    std::cerr << "Usage: " << program << " [options] > image.ppm\n"
+              << "  --threads N      worker threads, 0 for one per hardware thread (default 0)\n"
+              << "  --tile-size N    tile edge in pixels (default 32)\n"
+              << "  --format F       output format: ppm, pfm or exr (default ppm)\n"
+              << "  --output PATH    write the image to PATH instead of standard output\n"
+              << "  --scene PATH     render the scene file at PATH instead of the generated scene\n"
+              << "  --grid N         spheres of the generated scene span a 2N x 2N grid (default 11)\n"
+              << "  --write-scene PATH\n"
+              << "                   write the scene to PATH as a scene file and exit\n"
+              << "  --obj PATH       add the triangles of a Wavefront OBJ file to the scene\n"
+              << "  --cache DIR      keep the built geometry of each scene in DIR and map it\n"
+              << "                   from there on later runs\n"
+              << "  --no-packets     trace every ray on its own instead of in packets\n"
+              << "  --recursive      trace each path depth first (reference integrator)\n"
+              << "  --min-depth N    bounces before Russian roulette may end a path (default 3)\n"
+              << "  --target-error E sample each pixel until the relative error of its mean\n"
+              << "                   drops below E (default 0: fixed samples per pixel)\n"
+              << "  --min-samples N  adaptive samples per pixel and per round (default 16)\n"
+              << "  --max-samples N  adaptive samples per pixel at most (default 256)\n"
+              << "  --samples-output PATH\n"
+              << "                   write the samples taken per pixel, over the maximum, to PATH\n"
+              << "  --samples N      fixed samples per pixel (default: from the scene)\n"
+              << "  --pass-samples N render in passes of N more samples per pixel (default: one pass)\n"
+              << "  --checkpoint PATH\n"
+              << "                   save the accumulated samples to PATH after every pass\n"
+              << "  --resume         continue the render saved in the checkpoint\n"
+              << "  --isa L          instruction set: auto, sse4.1, avx2 or avx512 (default auto)\n"
+              << "  --stats PATH     write the ray statistics of the render to PATH as JSON\n"
+              << "  --frames N       render N frames of the scene's motions, to an --output\n"
+              << "                   path with a frame number field such as frame%04d.ppm\n"
+              << "  --coordinator ADDRESS\n"
+              << "                   deal the tiles to worker processes connecting to ADDRESS,\n"
+              << "                   a Unix domain socket path or HOST:PORT for TCP\n"
+              << "  --worker ADDRESS render tiles for the coordinator at ADDRESS, with the same\n"
+              << "                   scene options\n"
+              << "  --spawn N        start N workers on this machine for the coordinator\n"
+              << "  --denoise        filter the noise out of the image, guided by the albedo,\n"
+              << "                   normal and depth of the first hits\n"
+              << "  --sampler S      numbers of the samples: random, stratified, halton or sobol\n"
+              << "                   (default sobol)\n";
+}
+
+// Parses the command line into opts. Returns false on unknown or malformed
+// arguments, after printing the usage.
+inline bool parse_options(int argc, char* argv[], render_options& opts) {
+    for (int a = 1; a < argc; a++) {
+        const char* arg = argv[a];
+        const char* value = a + 1 < argc ? argv[a + 1] : nullptr;
+
+        if (!strcmp(arg, "--threads") && value && parse_count(value, opts.thread_count)) {
+            a++;
+        } else if (!strcmp(arg, "--tile-size") && value && atoi(value) > 0) {
+            opts.tile_size = atoi(value);
+            a++;
+        } else if (!strcmp(arg, "--format") && value && parse_image_format(value, opts.format)) {
+            a++;
+        } else if (!strcmp(arg, "--output") && value) {
+            opts.output_path = value;
+            a++;
+        } else if (!strcmp(arg, "--scene") && value) {
+            opts.scene_path = value;
+            a++;
+        } else if (!strcmp(arg, "--grid") && value && atoi(value) >= 0) {
+            opts.grid = atoi(value);
+            a++;
+        } else if (!strcmp(arg, "--write-scene") && value) {
+            opts.scene_output = value;
+            a++;
+        } else if (!strcmp(arg, "--obj") && value) {
+            opts.obj_path = value;
+            a++;
+        } else if (!strcmp(arg, "--cache") && value) {
+            opts.cache_dir = value;
+            a++;
+        } else if (!strcmp(arg, "--no-packets")) {
+            opts.packets = false;
+        } else if (!strcmp(arg, "--recursive")) {
+            opts.wavefront = false;
+        } else if (!strcmp(arg, "--min-depth") && value && atoi(value) >= 0) {
+            opts.min_depth = atoi(value);
+            a++;
+        } else if (!strcmp(arg, "--target-error") && value && atof(value) >= 0) {
+            opts.target_error = atof(value);
+            a++;
+        } else if (!strcmp(arg, "--min-samples") && value && atoi(value) > 0) {
+            opts.min_samples = atoi(value);
+            a++;
+        } else if (!strcmp(arg, "--max-samples") && value && atoi(value) > 0) {
+            opts.max_samples = atoi(value);
+            a++;
+        } else if (!strcmp(arg, "--samples-output") && value) {
+            opts.samples_output = value;
+            a++;
+        } else if (!strcmp(arg, "--samples") && value && atoi(value) > 0) {
+            opts.samples_per_pixel = atoi(value);
+            a++;
+        } else if (!strcmp(arg, "--pass-samples") && value && atoi(value) > 0) {
+            opts.pass_samples = atoi(value);
+            a++;
+        } else if (!strcmp(arg, "--checkpoint") && value) {
+            opts.checkpoint_path = value;
+            a++;
+        } else if (!strcmp(arg, "--resume")) {
+            opts.resume = true;
+        } else if (!strcmp(arg, "--isa") && value && parse_isa(value, opts.isa)) {
+            a++;
+        } else if (!strcmp(arg, "--stats") && value) {
+            opts.stats_path = value;
+            a++;
+        } else if (!strcmp(arg, "--frames") && value && atoi(value) > 0) {
+            opts.frames = atoi(value);
+            a++;
+        } else if (!strcmp(arg, "--coordinator") && value) {
+            opts.coordinator_address = value;
+            a++;
+        } else if (!strcmp(arg, "--worker") && value) {
+            opts.worker_address = value;
+            a++;
+        } else if (!strcmp(arg, "--spawn") && value && atoi(value) > 0) {
+            opts.spawn_workers = atoi(value);
+            a++;
+        } else if (!strcmp(arg, "--denoise")) {
+            opts.denoise = true;
+        } else if (!strcmp(arg, "--sampler") && value && parse_sampler_type(value, opts.sampler)) {
+            a++;
+        } else {
+            print_usage(argv[0]);
+            return false;
+        }
+    }
+
+    if (opts.max_samples < opts.min_samples || (opts.resume && !opts.checkpoint_path)
+        || (opts.coordinator_address && opts.worker_address) || (opts.spawn_workers && !opts.coordinator_address)) {
+        print_usage(argv[0]);
+        return false;
+    }
+
+    // Every frame needs a file of its own, and a checkpoint holds one frame
+    size_t start, length;
+    if (opts.frames > 1 && (!opts.output_path || !find_frame_field(opts.output_path, start, length)
+                            || (opts.samples_output && !find_frame_field(opts.samples_output, start, length))
+                            || opts.checkpoint_path)) {
+        print_usage(argv[0]);
+        return false;
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,265 @@
+#ifndef PACKET_H
+#define PACKET_H
+
+#include "rtweekend.h"
+#include "isa.h"
+
+#include <immintrin.h>
+
+/**
+** Lane-wise real vector for packet tracing, as wide as the instruction set
+** allows: 8 floats or 4 doubles with AVX2, 4 floats or 2 doubles with
+** SSE4.1. Comparisons return all-ones/all-zeros lane masks.
+*/
+#if defined(MATH_BACKEND_DOUBLE) && defined(SIMD_AVX2)
+
+const int packet_width = 4;
+
+class preal {
+    public:
+        inline preal() {}
+        inline preal(double f) : v(_mm256_set1_pd(f)) {}
+        inline preal(__m256d m) : v(m) {}
+
+        inline static preal load(const double* p) { return _mm256_loadu_pd(p); }
+        inline void store(double* p) const { _mm256_storeu_pd(p, v); }
+
+        // Mask with the lanes whose bit is set in bits
+        inline static preal lane_mask(int bits) {
+            const __m256i lane_bits = _mm256_setr_epi64x(1, 2, 4, 8);
+            __m256i b = _mm256_and_si256(_mm256_set1_epi64x(bits), lane_bits);
+            return _mm256_castsi256_pd(_mm256_cmpeq_epi64(b, lane_bits));
+        }
+
+    public:
+        __m256d v;
+};
+
+inline preal operator+(preal a, preal b) { return _mm256_add_pd(a.v, b.v); }
+inline preal operator-(preal a, preal b) { return _mm256_sub_pd(a.v, b.v); }
+inline preal operator*(preal a, preal b) { return _mm256_mul_pd(a.v, b.v); }
+inline preal operator/(preal a, preal b) { return _mm256_div_pd(a.v, b.v); }
+inline preal operator-(preal a) { return _mm256_xor_pd(a.v, _mm256_set1_pd(-0.0)); }
+
+inline preal operator<(preal a, preal b)  { return _mm256_cmp_pd(a.v, b.v, _CMP_LT_OQ); }
+inline preal operator<=(preal a, preal b) { return _mm256_cmp_pd(a.v, b.v, _CMP_LE_OQ); }
+inline preal operator>(preal a, preal b)  { return _mm256_cmp_pd(a.v, b.v, _CMP_GT_OQ); }
+inline preal operator>=(preal a, preal b) { return _mm256_cmp_pd(a.v, b.v, _CMP_GE_OQ); }
+inline preal operator&(preal a, preal b)  { return _mm256_and_pd(a.v, b.v); }
+inline preal operator|(preal a, preal b)  { return _mm256_or_pd(a.v, b.v); }
+
+inline preal min(preal a, preal b) { return _mm256_min_pd(a.v, b.v); }
+inline preal max(preal a, preal b) { return _mm256_max_pd(a.v, b.v); }
+inline preal sqrt(preal a) { return _mm256_sqrt_pd(a.v); }
+
+// Lane-wise mask ? a : b
+inline preal select(preal mask, preal a, preal b) { return _mm256_blendv_pd(b.v, a.v, mask.v); }
+inline int movemask(preal mask) { return _mm256_movemask_pd(mask.v); }
+
+#elif defined(MATH_BACKEND_DOUBLE)
+
+const int packet_width = 2;
+
+class preal {
+    public:
+        inline preal() {}
+        inline preal(double f) : v(_mm_set1_pd(f)) {}
+        inline preal(__m128d m) : v(m) {}
+
+        inline static preal load(const double* p) { return _mm_loadu_pd(p); }
+        inline void store(double* p) const { _mm_storeu_pd(p, v); }
+
+        // Mask with the lanes whose bit is set in bits
+        inline static preal lane_mask(int bits) {
+            const __m128i lane_bits = _mm_set_epi64x(2, 1);
+            __m128i b = _mm_and_si128(_mm_set1_epi64x(bits), lane_bits);
+            return _mm_castsi128_pd(_mm_cmpeq_epi64(b, lane_bits));
+        }
+
+    public:
+        __m128d v;
+};
+
+inline preal operator+(preal a, preal b) { return _mm_add_pd(a.v, b.v); }
+inline preal operator-(preal a, preal b) { return _mm_sub_pd(a.v, b.v); }
+inline preal operator*(preal a, preal b) { return _mm_mul_pd(a.v, b.v); }
+inline preal operator/(preal a, preal b) { return _mm_div_pd(a.v, b.v); }
+inline preal operator-(preal a) { return _mm_xor_pd(a.v, _mm_set1_pd(-0.0)); }
+
+inline preal operator<(preal a, preal b)  { return _mm_cmplt_pd(a.v, b.v); }
+inline preal operator<=(preal a, preal b) { return _mm_cmple_pd(a.v, b.v); }
+inline preal operator>(preal a, preal b)  { return _mm_cmpgt_pd(a.v, b.v); }
+inline preal operator>=(preal a, preal b) { return _mm_cmpge_pd(a.v, b.v); }
+inline preal operator&(preal a, preal b)  { return _mm_and_pd(a.v, b.v); }
+inline preal operator|(preal a, preal b)  { return _mm_or_pd(a.v, b.v); }
+
+inline preal min(preal a, preal b) { return _mm_min_pd(a.v, b.v); }
+inline preal max(preal a, preal b) { return _mm_max_pd(a.v, b.v); }
+inline preal sqrt(preal a) { return _mm_sqrt_pd(a.v); }
+
+// Lane-wise mask ? a : b
+inline preal select(preal mask, preal a, preal b) { return _mm_blendv_pd(b.v, a.v, mask.v); }
+inline int movemask(preal mask) { return _mm_movemask_pd(mask.v); }
+
+#elif defined(SIMD_AVX2)
+
+const int packet_width = 8;
+
+class preal {
+    public:
+        inline preal() {}
+        inline preal(float f) : v(_mm256_set1_ps(f)) {}
+        inline preal(__m256 m) : v(m) {}
+
+        inline static preal load(const float* p) { return _mm256_loadu_ps(p); }
+        inline void store(float* p) const { _mm256_storeu_ps(p, v); }
+
+        // Mask with the lanes whose bit is set in bits
+        inline static preal lane_mask(int bits) {
+            const __m256i lane_bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+            __m256i b = _mm256_and_si256(_mm256_set1_epi32(bits), lane_bits);
+            return _mm256_castsi256_ps(_mm256_cmpeq_epi32(b, lane_bits));
+        }
+
+    public:
+        __m256 v;
+};
+
+inline preal operator+(preal a, preal b) { return _mm256_add_ps(a.v, b.v); }
+inline preal operator-(preal a, preal b) { return _mm256_sub_ps(a.v, b.v); }
+inline preal operator*(preal a, preal b) { return _mm256_mul_ps(a.v, b.v); }
+inline preal operator/(preal a, preal b) { return _mm256_div_ps(a.v, b.v); }
+inline preal operator-(preal a) { return _mm256_xor_ps(a.v, _mm256_set1_ps(-0.0f)); }
+
+inline preal operator<(preal a, preal b)  { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+inline preal operator<=(preal a, preal b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ); }
+inline preal operator>(preal a, preal b)  { return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ); }
+inline preal operator>=(preal a, preal b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ); }
+inline preal operator&(preal a, preal b)  { return _mm256_and_ps(a.v, b.v); }
+inline preal operator|(preal a, preal b)  { return _mm256_or_ps(a.v, b.v); }
+
+inline preal min(preal a, preal b) { return _mm256_min_ps(a.v, b.v); }
+inline preal max(preal a, preal b) { return _mm256_max_ps(a.v, b.v); }
+inline preal sqrt(preal a) { return _mm256_sqrt_ps(a.v); }
+
+// Lane-wise mask ? a : b
+inline preal select(preal mask, preal a, preal b) { return _mm256_blendv_ps(b.v, a.v, mask.v); }
+inline int movemask(preal mask) { return _mm256_movemask_ps(mask.v); }
+
+#else
+
+const int packet_width = 4;
+
+class preal {
+    public:
+        inline preal() {}
+        inline preal(float f) : v(_mm_set1_ps(f)) {}
+        inline preal(__m128 m) : v(m) {}
+
+        inline static preal load(const float* p) { return _mm_loadu_ps(p); }
+        inline void store(float* p) const { _mm_storeu_ps(p, v); }
+
+        // Mask with the lanes whose bit is set in bits
+        inline static preal lane_mask(int bits) {
+            const __m128i lane_bits = _mm_setr_epi32(1, 2, 4, 8);
+            __m128i b = _mm_and_si128(_mm_set1_epi32(bits), lane_bits);
+            return _mm_castsi128_ps(_mm_cmpeq_epi32(b, lane_bits));
+        }
+
+    public:
+        __m128 v;
+};
+
+inline preal operator+(preal a, preal b) { return _mm_add_ps(a.v, b.v); }
+inline preal operator-(preal a, preal b) { return _mm_sub_ps(a.v, b.v); }
+inline preal operator*(preal a, preal b) { return _mm_mul_ps(a.v, b.v); }
+inline preal operator/(preal a, preal b) { return _mm_div_ps(a.v, b.v); }
+inline preal operator-(preal a) { return _mm_xor_ps(a.v, SIGNMASK); }
+
+inline preal operator<(preal a, preal b)  { return _mm_cmplt_ps(a.v, b.v); }
+inline preal operator<=(preal a, preal b) { return _mm_cmple_ps(a.v, b.v); }
+inline preal operator>(preal a, preal b)  { return _mm_cmpgt_ps(a.v, b.v); }
+inline preal operator>=(preal a, preal b) { return _mm_cmpge_ps(a.v, b.v); }
+inline preal operator&(preal a, preal b)  { return _mm_and_ps(a.v, b.v); }
+inline preal operator|(preal a, preal b)  { return _mm_or_ps(a.v, b.v); }
+
+inline preal min(preal a, preal b) { return _mm_min_ps(a.v, b.v); }
+inline preal max(preal a, preal b) { return _mm_max_ps(a.v, b.v); }
+inline preal sqrt(preal a) { return _mm_sqrt_ps(a.v); }
+
+// Lane-wise mask ? a : b
+inline preal select(preal mask, preal a, preal b) { return _mm_blendv_ps(b.v, a.v, mask.v); }
+inline int movemask(preal mask) { return _mm_movemask_ps(mask.v); }
+
+#endif
+
+const int packet_all_lanes = (1 << packet_width) - 1;
+
+/**
+** Structure-of-arrays 3D vector, one vec3 per lane.
+*/
+class pvec3 {
+    public:
+        inline pvec3() {}
+        inline pvec3(preal x, preal y, preal z) : x(x), y(y), z(z) {}
+        // Same vector in every lane
+        inline pvec3(const vec3& v) : x(v.x()), y(v.y()), z(v.z()) {}
+
+    public:
+        preal x, y, z;
+};
+
+inline pvec3 operator+(const pvec3& u, const pvec3& v) { return pvec3(u.x + v.x, u.y + v.y, u.z + v.z); }
+inline pvec3 operator-(const pvec3& u, const pvec3& v) { return pvec3(u.x - v.x, u.y - v.y, u.z - v.z); }
+inline pvec3 operator-(const pvec3& v) { return pvec3(-v.x, -v.y, -v.z); }
+inline pvec3 operator*(preal t, const pvec3& v) { return pvec3(t * v.x, t * v.y, t * v.z); }
+
+inline preal dot(const pvec3& u, const pvec3& v) {
+    return u.x * v.x + u.y * v.y + u.z * v.z;
+}
+
+inline pvec3 cross(const pvec3& u, const pvec3& v) {
+    return pvec3(u.y * v.z - u.z * v.y,
+                 u.z * v.x - u.x * v.z,
+                 u.x * v.y - u.y * v.x);
+}
+
+inline real lane(preal a, int i) {
+    alignas(32) real f[packet_width];
+    a.store(f);
+    return f[i];
+}
+
+/**
+** packet_width rays traced together. The rays are kept both in SoA form for
+** the intersection kernels and as plain rays for per-lane work.
+*/
+class ray_packet {
+    public:
+        ray_packet() {}
+
+        // Lanes that are not set in active get a copy of the first active ray,
+        // so that they never produce NaNs or denormals in the kernels
+        ray_packet(const ray* lane_rays, int active) {
+            int first = active ? __builtin_ctz(active) : 0;
+            alignas(32) real o[3][packet_width], d[3][packet_width];
+
+            for (int i = 0; i < packet_width; i++) {
+                rays[i] = lane_rays[(active >> i) & 1 ? i : first];
+                o[0][i] = rays[i].orig.x(); o[1][i] = rays[i].orig.y(); o[2][i] = rays[i].orig.z();
+                d[0][i] = rays[i].dir.x();  d[1][i] = rays[i].dir.y();  d[2][i] = rays[i].dir.z();
+            }
+
+            orig = pvec3(preal::load(o[0]), preal::load(o[1]), preal::load(o[2]));
+            dir = pvec3(preal::load(d[0]), preal::load(d[1]), preal::load(d[2]));
+            inv_dir = pvec3(preal(1.0) / dir.x, preal(1.0) / dir.y, preal(1.0) / dir.z);
+        }
+
+    public:
+        pvec3 orig;
+        pvec3 dir;
+        pvec3 inv_dir;
+        ray rays[packet_width];
+};
+
+#endif
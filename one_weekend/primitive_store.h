@@ -0,0 +1,539 @@
+#ifndef PRIMITIVE_STORE_H
+#define PRIMITIVE_STORE_H
+
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "flat_array.h"
+#include "hittable.h"
+#include "mesh.h"
+#include "packet.h"
+#include "ray_stats.h"
+#include "sphere.h"
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+template <typename T>
+void permute(flat_array<T>& v, const std::vector<int>& order) {
+    std::vector<T> sorted;
+    sorted.reserve(v.size());
+    for (int i : order)
+        sorted.push_back(v[i]);
+    v.assign(std::move(sorted));
+}
+
+// Float arrays are followed by packet_width unused entries, so that the
+// batched kernels can always load whole vectors
+inline void pad_for_packets(flat_array<real>& v, int size) {
+    v.resize(size + packet_width, 0.0f);
+}
+
+/**
+** Spheres as a structure of arrays. The batched kernel tests packet_width
+** spheres against one ray at once. Materials are indices into the owner's
+** material pointers, so that the arrays hold no pointers.
+*/
+struct sphere_soa {
+    flat_array<real> cx, cy, cz, radius;
+    flat_array<int> material;
+
+    int size() const { return static_cast<int>(material.size()); }
+
+    void add(const point3& center, real r, int m) {
+        int n = size();
+        for (auto* v : { &cx, &cy, &cz, &radius })
+            v->resize(n);
+        cx.push_back(center.x());
+        cy.push_back(center.y());
+        cz.push_back(center.z());
+        radius.push_back(r);
+        material.push_back(m);
+    }
+
+    aabb bounding_box(int i) const {
+        vec3 r(radius[i], radius[i], radius[i]);
+        point3 center(cx[i], cy[i], cz[i]);
+        return aabb(center - r, center + r);
+    }
+
+    void reorder(const std::vector<int>& order) {
+        int n = size();
+        for (auto* v : { &cx, &cy, &cz, &radius }) {
+            v->resize(n);
+            permute(*v, order);
+            pad_for_packets(*v, n);
+        }
+        permute(material, order);
+    }
+
+    // Calls f on every array, in a fixed order
+    template <typename F>
+    void for_each_array(F&& f) {
+        f(cx); f(cy); f(cz); f(radius); f(material);
+    }
+
+    // Whether the arrays are padded as reorder() leaves them and every
+    // material is below material_count
+    bool valid(int material_count) const {
+        size_t padded = material.size() + packet_width;
+        if (cx.size() < padded || cy.size() < padded || cz.size() < padded || radius.size() < padded)
+            return false;
+        for (size_t i = 0; i < material.size(); i++)
+            if (material[i] < 0 || material[i] >= material_count)
+                return false;
+        return true;
+    }
+
+    // Index of the nearest sphere in [first, first+count) hit within
+    // [t_min, t_max], or -1. t_max is narrowed to the hit distance.
+    int hit_range(const ray& r, int first, int count, real t_min, real& t_max) const;
+
+    // Lanes of the packet that hit sphere i within [t_min, t_max]
+    int hit_packet(int i, const ray_packet& r, real t_min, preal& t_max, int active) const;
+
+    void fill_record(int i, const ray& r, real t, hit_record& rec) const {
+        rec.t = t;
+        rec.p = r.at(t);
+        vec3 outward_normal = (rec.p - point3(cx[i], cy[i], cz[i])) / radius[i];
+        rec.set_face_normal(r, outward_normal);
+    }
+};
+
+/**
+** Triangles as a structure of arrays, with their edges and unit normal
+** computed once when they are added. Materials are kept by the owner, which
+** may have one per triangle or one for a whole mesh.
+*/
+struct triangle_soa {
+    flat_array<real> ax, ay, az;           // First vertex
+    flat_array<real> e1x, e1y, e1z;        // Second vertex minus the first
+    flat_array<real> e2x, e2y, e2z;        // Third vertex minus the first
+    flat_array<real> nx, ny, nz;
+    int triangle_count = 0;
+
+    int size() const { return triangle_count; }
+
+    void add(const point3& A, const point3& B, const point3& C) {
+        vec3 B_A = B - A;
+        vec3 C_A = C - A;
+        vec3 n = unit_vector(cross(B_A, C_A));
+
+        int size = this->size();
+        for (auto* v : arrays())
+            v->resize(size);
+        ax.push_back(A.x());    ay.push_back(A.y());    az.push_back(A.z());
+        e1x.push_back(B_A.x()); e1y.push_back(B_A.y()); e1z.push_back(B_A.z());
+        e2x.push_back(C_A.x()); e2y.push_back(C_A.y()); e2z.push_back(C_A.z());
+        nx.push_back(n.x());    ny.push_back(n.y());    nz.push_back(n.z());
+        triangle_count++;
+    }
+
+    aabb bounding_box(int i) const {
+        point3 A(ax[i], ay[i], az[i]);
+        aabb box = surrounding_box(aabb(A, A), A + vec3(e1x[i], e1y[i], e1z[i]));
+        box = surrounding_box(box, A + vec3(e2x[i], e2y[i], e2z[i]));
+        return padded(box);
+    }
+
+    void reorder(const std::vector<int>& order) {
+        int n = size();
+        for (auto* v : arrays()) {
+            v->resize(n);
+            permute(*v, order);
+            pad_for_packets(*v, n);
+        }
+    }
+
+    // Index of the nearest triangle in [first, first+count) hit within
+    // [t_min, t_max], or -1. t_max is narrowed to the hit distance.
+    int hit_range(const ray& r, int first, int count, real t_min, real& t_max) const;
+
+    // Lanes of the packet that hit triangle i within [t_min, t_max]
+    int hit_packet(int i, const ray_packet& r, real t_min, preal& t_max, int active) const;
+
+    void fill_record(int i, const ray& r, real t, hit_record& rec) const {
+        rec.t = t;
+        rec.p = r.origin() + t * r.direction();
+        rec.set_face_normal(r, vec3(nx[i], ny[i], nz[i]));
+    }
+
+    std::vector<flat_array<real>*> arrays() {
+        return { &ax, &ay, &az, &e1x, &e1y, &e1z, &e2x, &e2y, &e2z, &nx, &ny, &nz };
+    }
+
+    // Calls f on the triangle count and every array, in a fixed order
+    template <typename F>
+    void for_each_array(F&& f) {
+        f(triangle_count);
+        for (auto* v : arrays())
+            f(*v);
+    }
+
+    // Whether the arrays are padded as reorder() leaves them
+    bool valid() const {
+        if (triangle_count < 0)
+            return false;
+        for (const flat_array<real>* v : { &ax, &ay, &az, &e1x, &e1y, &e1z, &e2x, &e2y, &e2z, &nx, &ny, &nz })
+            if (v->size() < size_t(triangle_count) + packet_width)
+                return false;
+        return true;
+    }
+};
+
+int sphere_soa::hit_range(const ray& r, int first, int count, real t_min, real& t_max) const {
+    pvec3 o(r.orig);
+    pvec3 d(r.dir);
+    preal a = dot(d, d);
+
+    int nearest = -1;
+    for (int base = first; base < first + count; base += packet_width) {
+        int n = std::min(packet_width, first + count - base);
+
+        pvec3 A_C = o - pvec3(preal::load(&cx[base]), preal::load(&cy[base]), preal::load(&cz[base]));
+        preal rad = preal::load(&radius[base]);
+
+        preal half_b = dot(d, A_C);
+        preal c = dot(A_C, A_C) - rad*rad;
+        preal quarter_discriminant = half_b*half_b - a*c;
+        preal valid = preal::lane_mask((1 << n) - 1) & (quarter_discriminant >= preal(0.0f));
+        if (!movemask(valid))
+            continue;
+        preal sqrt_quarter_discriminant = sqrt(max(quarter_discriminant, preal(0.0f)));
+
+        // Nearest root in range, the far one where the near one is out
+        preal root = (-half_b - sqrt_quarter_discriminant) / a;
+        preal near_in_range = (root >= preal(t_min)) & (root <= preal(t_max));
+        root = select(near_in_range, root, (-half_b + sqrt_quarter_discriminant) / a);
+        int hits = movemask(valid & (root >= preal(t_min)) & (root <= preal(t_max)));
+        if (!hits)
+            continue;
+
+        alignas(32) real t[packet_width];
+        root.store(t);
+        for (int k = 0; k < n; k++) {
+            if (((hits >> k) & 1) && t[k] < t_max) {
+                t_max = t[k];
+                nearest = base + k;
+            }
+        }
+    }
+
+    return nearest;
+}
+
+int sphere_soa::hit_packet(int i, const ray_packet& r, real t_min, preal& t_max, int active) const {
+    pvec3 A_C = r.orig - pvec3(preal(cx[i]), preal(cy[i]), preal(cz[i]));
+
+    preal a = dot(r.dir, r.dir);
+    preal half_b = dot(r.dir, A_C);
+    preal c = dot(A_C, A_C) - preal(radius[i] * radius[i]);
+
+    preal quarter_discriminant = half_b*half_b - a*c;
+    preal valid = preal::lane_mask(active) & (quarter_discriminant >= preal(0.0f));
+    if (!movemask(valid))
+        return 0;
+    preal sqrt_quarter_discriminant = sqrt(max(quarter_discriminant, preal(0.0f)));
+
+    preal root = (-half_b - sqrt_quarter_discriminant) / a;
+    preal near_in_range = (root >= preal(t_min)) & (root <= t_max);
+    root = select(near_in_range, root, (-half_b + sqrt_quarter_discriminant) / a);
+    valid = valid & (root >= preal(t_min)) & (root <= t_max);
+
+    t_max = select(valid, root, t_max);
+    return movemask(valid);
+}
+
+int triangle_soa::hit_range(const ray& r, int first, int count, real t_min, real& t_max) const {
+    pvec3 o(r.orig);
+    pvec3 d(r.dir);
+    preal grazing(grazing_cosine * grazing_cosine * r.dir.length_squared());
+
+    int nearest = -1;
+    for (int base = first; base < first + count; base += packet_width) {
+        int n = std::min(packet_width, first + count - base);
+
+        pvec3 e1(preal::load(&e1x[base]), preal::load(&e1y[base]), preal::load(&e1z[base]));
+        pvec3 e2(preal::load(&e2x[base]), preal::load(&e2y[base]), preal::load(&e2z[base]));
+        pvec3 normal(preal::load(&nx[base]), preal::load(&ny[base]), preal::load(&nz[base]));
+        pvec3 O_A = o - pvec3(preal::load(&ax[base]), preal::load(&ay[base]), preal::load(&az[base]));
+
+        // Moller-Trumbore on the precomputed edges. D, l1 and l2 are the same
+        // determinant ratios that mesh::hit gets from Cramer's rule.
+        pvec3 p = cross(d, e2);
+        preal D = dot(e1, p);
+        pvec3 q = cross(O_A, e1);
+
+        preal l1 = dot(O_A, p) / D;
+        preal l2 = dot(d, q) / D;
+        preal t = dot(e2, q) / D;
+
+        // Rays along the plane of a triangle miss it, see grazing_cosine
+        preal cosine = dot(normal, d);
+        preal valid = preal::lane_mask((1 << n) - 1) & (cosine * cosine > grazing)
+                     & (l1 >= preal(0.0f)) & (l2 >= preal(0.0f)) & (l1 + l2 <= preal(1.0f))
+                     & (t >= preal(t_min)) & (t <= preal(t_max));
+        int hits = movemask(valid);
+        if (!hits)
+            continue;
+
+        alignas(32) real t_lanes[packet_width];
+        t.store(t_lanes);
+        for (int k = 0; k < n; k++) {
+            if (((hits >> k) & 1) && t_lanes[k] < t_max) {
+                t_max = t_lanes[k];
+                nearest = base + k;
+            }
+        }
+    }
+
+    return nearest;
+}
+
+int triangle_soa::hit_packet(int i, const ray_packet& r, real t_min, preal& t_max, int active) const {
+    pvec3 e1(preal(e1x[i]), preal(e1y[i]), preal(e1z[i]));
+    pvec3 e2(preal(e2x[i]), preal(e2y[i]), preal(e2z[i]));
+    pvec3 O_A = r.orig - pvec3(preal(ax[i]), preal(ay[i]), preal(az[i]));
+
+    pvec3 p = cross(r.dir, e2);
+    preal D = dot(e1, p);
+    pvec3 q = cross(O_A, e1);
+
+    preal l1 = dot(O_A, p) / D;
+    preal l2 = dot(r.dir, q) / D;
+    preal t = dot(e2, q) / D;
+
+    preal cosine = dot(pvec3(preal(nx[i]), preal(ny[i]), preal(nz[i])), r.dir);
+    preal grazing = preal(grazing_cosine * grazing_cosine) * dot(r.dir, r.dir);
+    preal valid = preal::lane_mask(active) & (cosine * cosine > grazing)
+                 & (l1 >= preal(0.0f)) & (l2 >= preal(0.0f)) & (l1 + l2 <= preal(1.0f))
+                 & (t >= preal(t_min)) & (t <= t_max);
+
+    t_max = select(valid, t, t_max);
+    return movemask(valid);
+}
+
+/**
+** Flattened scene geometry: spheres and triangles stored by value in
+** structure-of-arrays form, each kind under its own BVH whose leaves are
+** tested with the batched kernels. Can replace a hittable_list of spheres
+** and meshes; build() has to be called once everything is added. The
+** arrays and trees may instead be views of a geometry cache, see
+** geometry_cache.h.
+*/
+class primitive_store : public hittable {
+    public:
+        primitive_store() {}
+
+        void add(const shared_ptr<sphere>& s) { add_sphere(s->center, s->radius, add_material(s->mat_ptr)); }
+        void add(const shared_ptr<mesh>& m) { add_triangle(m->A, m->B, m->C, add_material(m->mat_ptr)); }
+
+        // Index of m in materials, where it is added the first time
+        int add_material(const material* m) {
+            auto found = material_index.emplace(m, static_cast<int>(materials.size()));
+            if (found.second)
+                materials.push_back(m);
+            return found.first->second;
+        }
+
+        // Same without a hittable per primitive, for scenes built from files.
+        // material is an index returned by add_material.
+        void add_sphere(const point3& center, real radius, int material) {
+            spheres.add(center, radius, material);
+        }
+        void add_triangle(const point3& A, const point3& B, const point3& C, int material) {
+            triangles.add(A, B, C);
+            triangle_material.push_back(material);
+        }
+
+        void build();
+
+        virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec)
+            const override;
+
+        virtual bool bounding_box(aabb& output_box) const override;
+
+        virtual bool occluded(const ray& r, real t_min, real t_max) const override;
+
+        virtual int hit_packet(const ray_packet& r, real t_min, preal& t_max, hit_record* rec, int active)
+            const override;
+
+        // Calls f on every array, trees included, in a fixed order
+        template <typename F>
+        void for_each_array(F&& f) {
+            spheres.for_each_array(f);
+            triangles.for_each_array(f);
+            f(triangle_material);
+            f(sphere_tree.nodes);
+            f(triangle_tree.nodes);
+        }
+
+        // Whether the arrays and trees are consistent with each other and
+        // the materials, for a store read from a geometry cache
+        bool valid() const;
+
+    public:
+        std::vector<const material*> materials;
+        sphere_soa spheres;
+        triangle_soa triangles;
+        flat_array<int> triangle_material;
+        bvh_tree sphere_tree;
+        bvh_tree triangle_tree;
+
+        // Index in the light list of every sphere and triangle, -1 for those
+        // that are not lights; see scene_lights
+        std::vector<int> sphere_light;
+        std::vector<int> triangle_light;
+
+    private:
+        static const int max_leaf_size = 2 * packet_width;
+        std::unordered_map<const material*, int> material_index;
+};
+
+bool primitive_store::valid() const {
+    int material_count = static_cast<int>(materials.size());
+    if (!spheres.valid(material_count) || !triangles.valid()
+        || triangle_material.size() != size_t(triangles.size()))
+        return false;
+    for (size_t i = 0; i < triangle_material.size(); i++)
+        if (triangle_material[i] < 0 || triangle_material[i] >= material_count)
+            return false;
+    return sphere_tree.valid(spheres.size()) && triangle_tree.valid(triangles.size());
+}
+
+void primitive_store::build() {
+    std::vector<aabb> boxes(spheres.size());
+    for (int i = 0; i < spheres.size(); i++)
+        boxes[i] = spheres.bounding_box(i);
+    spheres.reorder(sphere_tree.build(boxes, max_leaf_size));
+
+    boxes.resize(triangles.size());
+    for (int i = 0; i < triangles.size(); i++)
+        boxes[i] = triangles.bounding_box(i);
+    std::vector<int> order = triangle_tree.build(boxes, max_leaf_size);
+    triangles.reorder(order);
+    permute(triangle_material, order);
+
+    sphere_light.assign(spheres.size(), -1);
+    triangle_light.assign(triangles.size(), -1);
+}
+
+bool primitive_store::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+    real closest_so_far = t_max;
+    int nearest_sphere = -1;
+    int nearest_triangle = -1;
+
+    // Only the nearest primitive gets its hit record filled in
+    ray_stats& stats = thread_ray_stats;
+    sphere_tree.traverse(r, t_min, closest_so_far, [&](int first, int count, real& closest) {
+        int i = spheres.hit_range(r, first, count, t_min, closest);
+        stats.test(primitive_kind::sphere, count, i >= 0);
+        if (i < 0)
+            return false;
+        nearest_sphere = i;
+        closest_so_far = closest;
+        return true;
+    });
+
+    triangle_tree.traverse(r, t_min, closest_so_far, [&](int first, int count, real& closest) {
+        int i = triangles.hit_range(r, first, count, t_min, closest);
+        stats.test(primitive_kind::triangle, count, i >= 0);
+        if (i < 0)
+            return false;
+        nearest_triangle = i;
+        closest_so_far = closest;
+        return true;
+    });
+
+    if (nearest_triangle >= 0) {
+        triangles.fill_record(nearest_triangle, r, closest_so_far, rec);
+        rec.mat_ptr = materials[triangle_material[nearest_triangle]];
+        rec.light = triangle_light[nearest_triangle];
+    }
+    else if (nearest_sphere >= 0) {
+        spheres.fill_record(nearest_sphere, r, closest_so_far, rec);
+        rec.mat_ptr = materials[spheres.material[nearest_sphere]];
+        rec.light = sphere_light[nearest_sphere];
+    }
+    else
+        return false;
+
+    return true;
+}
+
+bool primitive_store::occluded(const ray& r, real t_min, real t_max) const {
+    ray_stats& stats = thread_ray_stats;
+    bool blocked = sphere_tree.traverse_any(r, t_min, t_max, [&](int first, int count) {
+        real closest = t_max;
+        int i = spheres.hit_range(r, first, count, t_min, closest);
+        stats.test(primitive_kind::sphere, count, i >= 0);
+        return i >= 0;
+    });
+
+    return blocked || triangle_tree.traverse_any(r, t_min, t_max, [&](int first, int count) {
+        real closest = t_max;
+        int i = triangles.hit_range(r, first, count, t_min, closest);
+        stats.test(primitive_kind::triangle, count, i >= 0);
+        return i >= 0;
+    });
+}
+
+int primitive_store::hit_packet(const ray_packet& r, real t_min, preal& t_max, hit_record* rec, int active) const {
+    int nearest_sphere[packet_width];
+    int nearest_triangle[packet_width];
+    ray_stats& stats = thread_ray_stats;
+
+    int sphere_hits = sphere_tree.traverse_packet(r, t_min, t_max, active, [&](int first, int count, int mask) {
+        int hits = 0;
+        for (int i = first; i < first + count; i++) {
+            int lanes = spheres.hit_packet(i, r, t_min, t_max, mask);
+            for (int k = 0; k < packet_width; k++)
+                if ((lanes >> k) & 1)
+                    nearest_sphere[k] = i;
+            hits |= lanes;
+            stats.test(primitive_kind::sphere, __builtin_popcount(mask), __builtin_popcount(lanes));
+        }
+        return hits;
+    });
+
+    int triangle_hits = triangle_tree.traverse_packet(r, t_min, t_max, active, [&](int first, int count, int mask) {
+        int hits = 0;
+        for (int i = first; i < first + count; i++) {
+            int lanes = triangles.hit_packet(i, r, t_min, t_max, mask);
+            for (int k = 0; k < packet_width; k++)
+                if ((lanes >> k) & 1)
+                    nearest_triangle[k] = i;
+            hits |= lanes;
+            stats.test(primitive_kind::triangle, __builtin_popcount(mask), __builtin_popcount(lanes));
+        }
+        return hits;
+    });
+
+    // A triangle hit always narrowed t_max past every sphere hit of its lane
+    alignas(32) real t[packet_width];
+    t_max.store(t);
+    for (int k = 0; k < packet_width; k++) {
+        if ((triangle_hits >> k) & 1) {
+            triangles.fill_record(nearest_triangle[k], r.rays[k], t[k], rec[k]);
+            rec[k].mat_ptr = materials[triangle_material[nearest_triangle[k]]];
+            rec[k].light = triangle_light[nearest_triangle[k]];
+        }
+        else if ((sphere_hits >> k) & 1) {
+            spheres.fill_record(nearest_sphere[k], r.rays[k], t[k], rec[k]);
+            rec[k].mat_ptr = materials[spheres.material[nearest_sphere[k]]];
+            rec[k].light = sphere_light[nearest_sphere[k]];
+        }
+    }
+
+    return sphere_hits | triangle_hits;
+}
+
+bool primitive_store::bounding_box(aabb& output_box) const {
+    if (sphere_tree.nodes.empty() && triangle_tree.nodes.empty())
+        return false;
+    output_box = surrounding_box(sphere_tree.bounding_box(), triangle_tree.bounding_box());
+    return true;
+}
+
+#endif
@@ -0,0 +1,135 @@
+#ifndef RAY_STATS_H
+#define RAY_STATS_H
+
+#include "rtweekend.h"
+#include "material.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+
+// How a path ended
+enum class path_end { miss, absorbed, roulette, depth, light };
+const int path_end_count = 5;
+
+enum class primitive_kind { sphere, triangle };
+const int primitive_kind_count = 2;
+
+// Counters of the rays one thread traced. Every thread counts into its own
+// thread_ray_stats without synchronization, and the renderer merges them
+// when the work is done. Plain data, so that a zeroed one is empty.
+struct ray_stats {
+    static const int depth_buckets = 64;   // The last one counts deeper paths too
+
+    uint64_t primary_rays;
+    uint64_t secondary_rays;
+    uint64_t shadow_rays;
+    uint64_t tests[primitive_kind_count];  // Ray-primitive intersection tests
+    uint64_t hits[primitive_kind_count];   // Tests that found a closer hit
+    uint64_t path_ends[path_end_count];
+    uint64_t path_depths[depth_buckets];   // Paths by the bounces they took
+    uint64_t scatter_rejections[material_type_count];
+
+    // A ray cast after the given number of bounces
+    void cast(int bounces, uint64_t rays = 1) {
+        if (bounces == 0)
+            primary_rays += rays;
+        else
+            secondary_rays += rays;
+    }
+
+    // A shadow ray cast towards a light
+    void shadow(uint64_t rays = 1) { shadow_rays += rays; }
+
+    void test(primitive_kind kind, uint64_t count, uint64_t closer_hits) {
+        tests[static_cast<int>(kind)] += count;
+        hits[static_cast<int>(kind)] += closer_hits;
+    }
+
+    void end_path(path_end how, int bounces) {
+        path_ends[static_cast<int>(how)]++;
+        path_depths[bounces < depth_buckets ? bounces : depth_buckets - 1]++;
+    }
+
+    void reject_scatter(material_type type) { scatter_rejections[static_cast<int>(type)]++; }
+
+    uint64_t rays() const { return primary_rays + secondary_rays + shadow_rays; }
+
+    // Every sample is one path, which ends exactly once
+    uint64_t paths() const {
+        uint64_t n = 0;
+        for (uint64_t x : path_ends)
+            n += x;
+        return n;
+    }
+
+    void merge(const ray_stats& s) {
+        const uint64_t* from = reinterpret_cast<const uint64_t*>(&s);
+        uint64_t* to = reinterpret_cast<uint64_t*>(this);
+        for (size_t k = 0; k < sizeof(ray_stats) / sizeof(uint64_t); k++)
+            to[k] += from[k];
+    }
+};
+
+// Counters of the calling thread
+thread_local ray_stats thread_ray_stats;
+
+const char* const path_end_names[path_end_count] = { "miss", "absorbed", "roulette", "depth", "light" };
+const char* const primitive_kind_names[primitive_kind_count] = { "sphere", "triangle" };
+const char* const material_type_names[material_type_count] = { "lambertian", "metal", "dielectric", "diffuse_light" };
+
+// Short summary of a render that took seconds
+void print_ray_stats(std::ostream& out, const ray_stats& s, double seconds) {
+    char line[256];
+    snprintf(line, sizeof(line), "Render time: %.3f s, %.2f Mrays/s, %.0f samples/s\n",
+             seconds, s.rays() / seconds * 1e-6, s.paths() / seconds);
+    out << line;
+    snprintf(line, sizeof(line), "Rays: %llu primary, %llu secondary, %llu shadow\n",
+             (unsigned long long) s.primary_rays, (unsigned long long) s.secondary_rays,
+             (unsigned long long) s.shadow_rays);
+    out << line;
+
+    out << "Tests (hits):";
+    for (int k = 0; k < primitive_kind_count; k++)
+        out << ' ' << primitive_kind_names[k] << ' ' << s.tests[k] << " (" << s.hits[k] << ')';
+    out << "\nPaths ended by:";
+    for (int k = 0; k < path_end_count; k++)
+        out << ' ' << path_end_names[k] << ' ' << s.path_ends[k];
+    out << "\nScatter rejections:";
+    for (int k = 0; k < material_type_count; k++)
+        out << ' ' << material_type_names[k] << ' ' << s.scatter_rejections[k];
+    out << '\n';
+}
+
+// Everything in the counters, for tracking them across builds. Writes to the
+// open file f; info is a JSON fragment of "key": value pairs put first.
+void write_ray_stats_json(FILE* f, const char* info, const ray_stats& s, double seconds) {
+    auto array = [&](const char* name, const uint64_t* values, const char* const* names, int count) {
+        fprintf(f, "  \"%s\": {", name);
+        for (int k = 0; k < count; k++)
+            fprintf(f, "%s\"%s\": %llu", k ? ", " : "", names[k], (unsigned long long) values[k]);
+        fprintf(f, "},\n");
+    };
+
+    fprintf(f, "{\n  %s,\n", info);
+    fprintf(f, "  \"seconds\": %.6f,\n  \"mrays_per_s\": %.3f,\n  \"samples_per_s\": %.1f,\n",
+            seconds, s.rays() / seconds * 1e-6, s.paths() / seconds);
+    fprintf(f, "  \"samples\": %llu,\n  \"rays\": {\"primary\": %llu, \"secondary\": %llu, \"shadow\": %llu},\n",
+            (unsigned long long) s.paths(), (unsigned long long) s.primary_rays,
+            (unsigned long long) s.secondary_rays, (unsigned long long) s.shadow_rays);
+    array("tests", s.tests, primitive_kind_names, primitive_kind_count);
+    array("hits", s.hits, primitive_kind_names, primitive_kind_count);
+    array("path_ends", s.path_ends, path_end_names, path_end_count);
+    array("scatter_rejections", s.scatter_rejections, material_type_names, material_type_count);
+
+    // Trailing empty buckets are left out
+    int depths = ray_stats::depth_buckets;
+    while (depths > 0 && s.path_depths[depths - 1] == 0)
+        depths--;
+    fprintf(f, "  \"path_depths\": [");
+    for (int k = 0; k < depths; k++)
+        fprintf(f, "%s%llu", k ? ", " : "", (unsigned long long) s.path_depths[k]);
+    fprintf(f, "]\n}\n");
+}
+
+#endif
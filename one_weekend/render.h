@@ -0,0 +1,441 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include "rtweekend.h"
+
+#include "hittable_list.h"
+#include "camera.h"
+#include "sphere.h"
+#include "mesh.h"
+#include "material.h"
+#include "primitive_store.h"
+#include "triangle_mesh.h"
+#include "obj_loader.h"
+#include "framebuffer.h"
+#include "thread_pool.h"
+#include "image_writer.h"
+#include "options.h"
+#include "integrator.h"
+#include "adaptive.h"
+#include "checkpoint.h"
+#include "scene.h"
+#include "scene_file.h"
+#include "geometry_cache.h"
+#include "ray_stats.h"
+#include "animation.h"
+#include "distributed.h"
+#include "denoise.h"
+
+#include <atomic>
+#include <chrono>
+#include <fcntl.h>
+#include <iostream>
+#include <memory>
+#include <mutex>
+
+// Builds the scene and renders it. Included by the render_<isa>.cpp files,
+// which build the renderer once per instruction set in separate namespaces.
+int render(const render_options& opts) {
+    if (!opts.worker_address)
+        std::cerr << "Math backend: " << math_backend::name() << '\n';
+
+    // A coordinator listens first thing, so that workers can connect while
+    // it loads the scene. Both ends check that they load the same one, and
+    // so does a checkpoint.
+    const char* distributed_address = opts.coordinator_address ? opts.coordinator_address : opts.worker_address;
+    socket_address address;
+    int listen_fd = -1;
+    uint64_t scene_key = 0;
+    if (distributed_address) {
+        if (!parse_socket_address(distributed_address, address)
+            || (opts.coordinator_address && (listen_fd = listen_socket(address)) < 0)) {
+            std::cerr << "Cannot listen on " << distributed_address << ": " << strerror(errno) << '\n';
+            return 1;
+        }
+    }
+    if ((distributed_address || opts.checkpoint_path)
+        && !geometry_cache_key(opts.scene_path, opts.grid, opts.obj_path, scene_key)) {
+        std::cerr << "Cannot read the scene file " << opts.scene_path << ": " << strerror(errno) << '\n';
+        return 1;
+    }
+
+    // World, from the geometry cache when there is one for this scene
+    scene_desc scene;
+    mapped_file cache_file;     // The arrays of geometry may point into it
+    scene_world geometry;
+    std::string cache_path;
+    bool cached = false;
+    uint64_t cache_key;
+    if (opts.cache_dir && !opts.scene_output
+        && geometry_cache_key(opts.scene_path, opts.grid, opts.obj_path, cache_key)) {
+        char name[32];
+        snprintf(name, sizeof(name), "/%016llx.rtwgeom", static_cast<unsigned long long>(cache_key));
+        cache_path = std::string(opts.cache_dir) + name;
+        cached = load_geometry_cache(cache_path.c_str(), cache_key, cache_file, scene, geometry);
+        if (!cached && errno != ENOENT)
+            std::cerr << "Rebuilding the geometry cache " << cache_path << ": " << strerror(errno) << '\n';
+    }
+
+    if (!cached) {
+        int error_line;
+        if (!opts.scene_path) {
+            scene = random_scene(opts.grid);
+        } else if (!load_scene(opts.scene_path, scene, error_line)) {
+            if (error_line)
+                std::cerr << opts.scene_path << ':' << error_line << ": malformed line\n";
+            else
+                std::cerr << "Cannot read the scene file " << opts.scene_path << ": " << strerror(errno) << '\n';
+            return 1;
+        }
+
+        if (opts.scene_output) {
+            if (!save_scene(opts.scene_output, scene)) {
+                std::cerr << "Cannot write the scene file " << opts.scene_output << ": " << strerror(errno) << '\n';
+                return 1;
+            }
+            return 0;
+        }
+
+        if (opts.obj_path)
+            scene.meshes.push_back({ opts.obj_path, scene.add_material(lambertian_material(color(0.7, 0.7, 0.7))) });
+
+        const char* failed_obj = nullptr;
+        if (!build_scene(scene, geometry, failed_obj)) {
+            std::cerr << "Cannot read the OBJ file " << failed_obj << '\n';
+            return 1;
+        }
+
+        // Not having a cache only costs the next run its startup time
+        if (!cache_path.empty() && !save_geometry_cache(cache_path.c_str(), cache_key, scene, geometry))
+            std::cerr << "Cannot write the geometry cache " << cache_path << ": " << strerror(errno) << '\n';
+    }
+    const hittable_list& world = geometry.world;
+    const scene_lights& lights = geometry.lights;
+
+    // Image
+    const auto aspect_ratio = scene.aspect_ratio;
+    const int image_width = scene.image_width;
+    const int image_height = scene.image_height();
+    const int samples_per_pixel = opts.samples_per_pixel > 0 ? opts.samples_per_pixel : scene.samples_per_pixel;
+    const int max_depth = scene.max_depth;
+    path_limits limits = { max_depth, opts.min_depth };
+
+    // Camera, and everything else that moves in a sequence of frames
+    scene_animation animation(scene, geometry);
+    const camera_settings& view = scene.camera;
+    camera cam(view.lookfrom, view.lookat, view.vup, view.vfov, aspect_ratio, view.aperture, view.focus_dist);
+
+    // Frames draw from their own sample generators, pixel indices past those
+    // of the frames before
+    uint64_t first_pixel = 0;
+
+    // Render
+    framebuffer image(image_width, image_height, opts.tile_size);
+    thread_pool pool(opts.thread_count);
+
+    sample_budget budget = { samples_per_pixel, samples_per_pixel, 0 };
+    if (opts.target_error > 0)
+        budget = { opts.min_samples, opts.max_samples, opts.target_error };
+
+    // Each pass brings every pixel up to pass_budget.max_samples
+    sample_budget pass_budget = budget;
+    int pass_samples = opts.pass_samples > 0 ? opts.pass_samples : budget.max_samples;
+
+    // Numbers of every sample, indexed by pixel, sample and dimension. The
+    // stratified sampler stratifies the samples a pixel takes at once: a
+    // pass, or a round of adaptive sampling. A resumed render keeps the
+    // strata of the checkpoint, and workers those of the coordinator.
+    sampler pixel_sampler = { opts.sampler, opts.target_error > 0 ? std::min(budget.min_samples, pass_samples) : pass_samples };
+
+    if (opts.resume && !load_checkpoint(opts.checkpoint_path, image, scene_key, pixel_sampler)) {
+        if (errno == EINVAL)
+            std::cerr << "Cannot resume from " << opts.checkpoint_path
+                      << ": not a checkpoint of this scene, sampler and image size\n";
+        else
+            std::cerr << "Cannot resume from " << opts.checkpoint_path << ": " << strerror(errno) << '\n';
+        return 1;
+    }
+
+    std::atomic<int> tiles_remaining(0);
+    std::mutex progress_lock;
+
+    // Queues and hit buffers of the wavefront integrator, one set per thread
+    std::vector<wavefront_integrator> integrators(pool.size(), wavefront_integrator(world, lights, limits, opts.packets));
+
+    // Ray counters of each thread, taken from thread_ray_stats after every tile,
+    // and of the workers of a coordinator
+    std::vector<ray_stats> thread_stats(pool.size());
+    ray_stats worker_stats = {};
+    double render_seconds = 0;
+
+    auto render_tile = [&](int tile_index, int thread_index) {
+        framebuffer::tile tile = image.tile_bounds(tile_index);
+
+        if (opts.wavefront) {
+            // Every sample of a round becomes a path of the queue, and the
+            // round ends when all of them are traced
+            wavefront_integrator& integrator = integrators[thread_index];
+            for (bool queued = true; queued; ) {
+                queued = false;
+                for (int j = tile.y1-1; j >= tile.y0; --j) {
+                    for (int i = tile.x0; i < tile.x1; ++i) {
+                        pixel_accumulator& pixel = image.at(i,j);
+                        int first = pixel.samples;
+                        int n = pass_budget.next_round(pixel);
+                        for (int s=first; s<first+n; ++s){
+                            sample_stream samples = pixel_sampler.start(first_pixel + uint64_t(j)*image_width + i, s);
+                            real u = (i + samples.next()) / (image_width-1);
+                            real v = (j + samples.next()) / (image_height-1);
+                            integrator.add_path(cam.get_ray(u,v,samples), samples, &pixel);
+                            if (integrator.full())
+                                integrator.trace();
+                        }
+                        queued |= n > 0;
+                    }
+                }
+                integrator.trace();
+            }
+        } else {
+            for (int j = tile.y1-1; j >= tile.y0; --j) {
+                for (int i = tile.x0; i < tile.x1; ++i) {
+                    pixel_accumulator& pixel = image.at(i,j);
+                    for (int n = pass_budget.next_round(pixel); n > 0; n = pass_budget.next_round(pixel)) {
+                        int end = pixel.samples + n;
+                        if (opts.packets) {
+                            // The samples of a pixel make up the lanes of a packet
+                            for (int s=pixel.samples; s<end; s+=packet_width){
+                                int lanes = std::min(packet_width, end - s);
+                                sample_stream samples[packet_width];
+                                ray rays[packet_width];
+                                color lane_colors[packet_width];
+                                for (int k=0; k<lanes; ++k){
+                                    samples[k] = pixel_sampler.start(first_pixel + uint64_t(j)*image_width + i, s + k);
+                                    real u = (i + samples[k].next()) / (image_width-1);
+                                    real v = (j + samples[k].next()) / (image_height-1);
+                                    rays[k] = cam.get_ray(u,v,samples[k]);
+                                }
+                                ray_color_packet(rays, (1 << lanes) - 1, world, lights, limits, samples, lane_colors);
+                                for (int k=0; k<lanes; ++k)
+                                    pixel.add(lane_colors[k]);
+                            }
+                        } else {
+                            for (int s=pixel.samples; s<end; ++s){
+                                sample_stream samples = pixel_sampler.start(first_pixel + uint64_t(j)*image_width + i, s);
+                                real u = (i + samples.next()) / (image_width-1);
+                                real v = (j + samples.next()) / (image_height-1);
+                                ray r = cam.get_ray(u,v,samples);
+                                pixel.add(ray_color(r,world,lights,limits,samples));
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        thread_stats[thread_index].merge(thread_ray_stats);
+        thread_ray_stats = ray_stats();
+
+        int remaining = --tiles_remaining;
+        if (opts.worker_address)
+            return;
+        std::lock_guard<std::mutex> guard(progress_lock);
+        std::cerr << "\rSamples per pixel: " << pass_budget.max_samples
+                  << ", tiles remaining: " << remaining << ' ' << std::flush;
+    };
+
+    // First-hit features of a tile for the denoiser, from the camera rays of
+    // the first few samples of each pixel. Their ray counts are left out of
+    // the statistics.
+    std::unique_ptr<atrous_denoiser> denoiser;
+    if (opts.denoise)
+        denoiser.reset(new atrous_denoiser(image_width, image_height));
+    const int feature_samples = 4;
+
+    auto gather_features = [&](int tile_index, int) {
+        framebuffer::tile tile = image.tile_bounds(tile_index);
+        for (int j = tile.y0; j < tile.y1; ++j) {
+            for (int i = tile.x0; i < tile.x1; ++i) {
+                int n = std::max(1, std::min(feature_samples, image.at(i,j).samples));
+                color albedo(0,0,0);
+                vec3 normal(0,0,0);
+                real depth = 0;
+                for (int s=0; s<n; ++s){
+                    sample_stream samples = pixel_sampler.start(first_pixel + uint64_t(j)*image_width + i, s);
+                    real u = (i + samples.next()) / (image_width-1);
+                    real v = (j + samples.next()) / (image_height-1);
+                    hit_record rec;
+                    if (world.hit(cam.get_ray(u,v,samples), 0.001, infinity, rec)) {
+                        albedo += rec.mat_ptr->albedo();
+                        normal += rec.normal;
+                        depth += rec.t;
+                    } else {
+                        albedo += color(1,1,1);
+                    }
+                }
+                denoiser->set_features(i, j, albedo / real(n), normal / real(n), depth / n);
+            }
+        }
+        thread_ray_stats = ray_stats();
+    };
+
+    // Poses the scene and the camera at frame
+    auto set_frame = [&](int frame) {
+        if (animation.animated()) {
+            camera_settings v = animation.set_frame(frame);
+            cam = camera(v.lookfrom, v.lookat, v.vup, v.vfov, aspect_ratio, v.aperture, v.focus_dist);
+        }
+        first_pixel = uint64_t(frame) * image_width * image_height;
+    };
+
+    // A worker renders the tiles it is dealt until the coordinator is done
+    if (opts.worker_address) {
+        int fd = connect_socket(address, 30);
+        tile_hello hello = make_tile_hello(scene_key, opts.sampler, image, static_cast<int>(pool.size()));
+        if (fd < 0 || !write_all(fd, &hello, sizeof(hello))) {
+            std::cerr << "Cannot connect to the coordinator at " << opts.worker_address << ": " << strerror(errno) << '\n';
+            return 1;
+        }
+
+        int current_frame = -1;
+        bool served = serve_tiles(fd, image, [&](int frame, const sample_budget& b, int strata,
+                                                 const std::vector<int>& tiles, ray_stats& stats) {
+            if (frame != current_frame) {
+                set_frame(frame);
+                current_frame = frame;
+            }
+            pass_budget = b;
+            pixel_sampler.strata = strata;
+            pool.parallel_for(static_cast<int>(tiles.size()), [&](int k, int thread_index) {
+                render_tile(tiles[k], thread_index);
+            });
+            for (ray_stats& s : thread_stats) {
+                stats.merge(s);
+                s = ray_stats();
+            }
+        });
+        close(fd);
+        if (!served) {
+            std::cerr << "Lost the coordinator at " << opts.worker_address << ": " << strerror(errno) << '\n';
+            return 1;
+        }
+        return 0;
+    }
+
+    std::unique_ptr<tile_coordinator> coordinator;
+    if (opts.coordinator_address) {
+        std::cerr << "Coordinating workers on " << opts.coordinator_address << '\n';
+        coordinator.reset(new tile_coordinator(listen_fd, address, scene_key, pixel_sampler, image));
+    }
+
+    for (int frame = 0; frame < opts.frames; frame++) {
+        auto setup_start = std::chrono::steady_clock::now();
+        set_frame(frame);
+        if (frame > 0)
+            image.clear();
+        double setup_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - setup_start).count();
+        double frame_seconds = render_seconds;
+
+        for (int pass_end = pass_samples; ; pass_end += pass_samples) {
+            pass_budget.max_samples = std::min(pass_end, budget.max_samples);
+            tiles_remaining = image.tile_count();
+            auto start = std::chrono::steady_clock::now();
+            if (!coordinator) {
+                pool.parallel_for(image.tile_count(), render_tile);
+            } else if (!coordinator->render_pass(frame, pass_budget, worker_stats)) {
+                std::cerr << "\nCannot wait for the workers: " << strerror(errno) << '\n';
+                return 1;
+            }
+            render_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            if (opts.checkpoint_path && !save_checkpoint(opts.checkpoint_path, image, scene_key, pixel_sampler)) {
+                std::cerr << "\nCannot write the checkpoint: " << strerror(errno) << '\n';
+                return 1;
+            }
+            if (pass_budget.max_samples == budget.max_samples)
+                break;
+        }
+
+        if (denoiser) {
+            auto start = std::chrono::steady_clock::now();
+            pool.parallel_for(image.tile_count(), gather_features);
+            denoiser->denoise(image, pool);
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            std::cerr << "\rDenoised in " << seconds << " s\n";
+        }
+
+        // Output
+        std::string output_path = opts.output_path ? frame_path(opts.output_path, frame) : std::string();
+        int fd = STDOUT_FILENO;
+        if (opts.output_path)
+            fd = open(output_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+        image_writer writer(fd, opts.format, image_width, image_height);
+        bool written = fd >= 0 && (denoiser ? write_pixels(writer, image_width, image_height, opts.tile_size,
+                                                           [&](int i, int j) { return denoiser->at(i, j); })
+                                            : write_image(writer, image));
+        if (!written) {
+            std::cerr << "\nCannot write the image: " << strerror(errno) << '\n';
+            return 1;
+        }
+        if (opts.output_path)
+            close(fd);
+
+        if (opts.samples_output) {
+            std::string samples_path = frame_path(opts.samples_output, frame);
+            int samples_fd = open(samples_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            image_writer samples_writer(samples_fd, opts.format, image_width, image_height);
+            if (samples_fd < 0 || !write_sample_counts(samples_writer, image, budget.max_samples)) {
+                std::cerr << "\nCannot write the sample counts: " << strerror(errno) << '\n';
+                return 1;
+            }
+            close(samples_fd);
+        }
+
+        if (opts.frames > 1) {
+            char line[128];
+            snprintf(line, sizeof(line), "\rFrame %d: set up in %.3f ms, rendered in %.3f s",
+                     frame, setup_seconds * 1e3, render_seconds - frame_seconds);
+            std::cerr << line << '\n';
+        }
+    }
+
+    // Statistics
+    ray_stats stats = worker_stats;
+    for (const ray_stats& s : thread_stats)
+        stats.merge(s);
+    std::cerr << '\n';
+    print_ray_stats(std::cerr, stats, render_seconds);
+
+    if (opts.stats_path) {
+        FILE* f = fopen(opts.stats_path, "w");
+        char info[256];
+        snprintf(info, sizeof(info),
+                 "\"backend\": \"%s\", \"isa\": \"%s\", \"threads\": %d, \"width\": %d, \"height\": %d, "
+                 "\"samples_per_pixel\": %d, \"sampler\": \"%s\", \"wavefront\": %s, \"packets\": %s",
+                 math_backend::name(), isa_name(opts.isa), static_cast<int>(pool.size()), image_width,
+                 image_height, budget.max_samples, sampler_type_name(opts.sampler), opts.wavefront ? "true" : "false",
+                 opts.packets ? "true" : "false");
+        bool ok = f != nullptr;
+        if (ok) {
+            write_ray_stats_json(f, info, stats, render_seconds);
+            ok = !ferror(f);
+            ok = fclose(f) == 0 && ok;
+        }
+        if (!ok) {
+            std::cerr << "Cannot write the statistics: " << strerror(errno) << '\n';
+            return 1;
+        }
+    }
+
+    if (coordinator) {
+        coordinator.reset();
+        close(listen_fd);
+        if (!address.unix_path.empty())
+            unlink(address.unix_path.c_str());
+    }
+
+    std::cerr << "Done.\n";
+    return 0;
+}
+
+#endif
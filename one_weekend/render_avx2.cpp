@@ -0,0 +1,18 @@
+// Build of the renderer for CPUs with AVX2 and FMA: 8-wide packets and fused
+// multiply-adds in the vector math. The target pragma is popped before the
+// end of the file, so the static initializers the compiler emits there stay
+// runnable on CPUs that never call into this build.
+
+#define SIMD_AVX2 1
+#define SIMD_FMA 1
+
+#include "render_prelude.h"
+
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+
+namespace isa_avx2 {
+#include "render.h"
+}
+
+#pragma GCC pop_options
@@ -0,0 +1,18 @@
+// Build of the renderer for CPUs with AVX-512 (F, VL, BW, DQ). The kernels
+// are those of the AVX2 build; the compiler is free to use the wider and
+// masked instructions where it vectorizes. The target pragma is popped before
+// the end of the file, as in render_avx2.cpp.
+
+#define SIMD_AVX2 1
+#define SIMD_FMA 1
+
+#include "render_prelude.h"
+
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512vl,avx512bw,avx512dq,avx2,fma")
+
+namespace isa_avx512 {
+#include "render.h"
+}
+
+#pragma GCC pop_options
@@ -0,0 +1,56 @@
+#ifndef RENDER_PRELUDE_H
+#define RENDER_PRELUDE_H
+
+// Everything render.h needs from outside this tree, included at file scope
+// before a render_<isa>.cpp opens its namespace. The include guards then keep
+// the nested includes of these headers from landing inside the namespace, so
+// add any new system header here too.
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <immintrin.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <smmintrin.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#if __APPLE__
+# include <stdlib.h>
+#else
+# include <malloc.h>
+#endif
+
+// Shared by every build of the renderer and by main.cpp
+#include "options.h"
+
+#endif
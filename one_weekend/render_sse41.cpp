@@ -0,0 +1,7 @@
+// Baseline build of the renderer, for any CPU with SSE4.1
+
+#include "render_prelude.h"
+
+namespace isa_sse41 {
+#include "render.h"
+}
@@ -4,6 +4,7 @@
 #include <cmath>
 #include <limits>
 #include <memory>
+#include <cstdint>
 #include <cstdlib>
 
 // Usings
@@ -11,26 +12,92 @@ using std::shared_ptr;
 using std::make_shared;
 using std::sqrt;
 
+// Math backend of vec3, picked at compile time:
+//   default               SSE4.1, float components in one __m128
+//   -DMATH_BACKEND_FLOAT  scalar float
+//   -DMATH_BACKEND_DOUBLE scalar double
+// real is the scalar type of the backend, used by everything else.
+#if defined(MATH_BACKEND_DOUBLE)
+typedef double real;
+#else
+typedef float real;
+#endif
+
 // Constants
-const double infinity = std::numeric_limits<double>::infinity();
-const double pi = 3.1415926535897932385;
+const real infinity = std::numeric_limits<real>::infinity();
+const real pi = 3.1415926535897932385;
 
 // Utility Functions
-inline double degrees_to_radians(double degrees) {
+inline real degrees_to_radians(real degrees) {
     return degrees * pi / 180.0;
 }
 
-inline double random_double() {
+// PCG32 generator (see https://www.pcg-random.org): 64-bit LCG state with a
+// permuted 32-bit output. It is small enough to live on the stack of every
+// sample, so no state is shared between threads.
+class pcg32 {
+    public:
+        pcg32() : pcg32(0x853c49e6748fea9bULL, 0xda3e39cb94b95bdbULL) {}
+        pcg32(uint64_t init_state, uint64_t init_sequence) { seed(init_state, init_sequence); }
+
+        void seed(uint64_t init_state, uint64_t init_sequence) {
+            state = 0;
+            inc = (init_sequence << 1) | 1;
+            next_uint();
+            state += init_state;
+            next_uint();
+        }
+
+        uint32_t next_uint() {
+            uint64_t old_state = state;
+            state = old_state * 6364136223846793005ULL + inc;
+            uint32_t xorshifted = static_cast<uint32_t>(((old_state >> 18) ^ old_state) >> 27);
+            uint32_t rot = static_cast<uint32_t>(old_state >> 59);
+            return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+        }
+
+    public:
+        uint64_t state;
+        uint64_t inc;
+};
+
+// SplitMix64 finalizer, used to turn sample coordinates into seeds
+inline uint64_t hash_uint64(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// Generator for one sample of one pixel, starting at the given bounce. The
+// stream only depends on these counters, so an image comes out the same
+// whatever the number of threads or the order in which tiles are rendered.
+inline pcg32 sample_rng(uint64_t pixel, uint32_t sample, uint32_t bounce = 0) {
+    uint64_t key = hash_uint64(pixel ^ hash_uint64((uint64_t(sample) << 32) | bounce));
+    return pcg32(key, hash_uint64(key));
+}
+
+inline real unit_real(uint32_t bits) {
+    // Reads bits as a fraction in [0,1). A float keeps the top 24 bits, so
+    // that rounding never yields 1.
+#if defined(MATH_BACKEND_DOUBLE)
+    return bits * (1.0 / 4294967296.0);
+#else
+    return (bits >> 8) * (1.0f / 16777216.0f);
+#endif
+}
+
+inline real random_real(pcg32& rng) {
     // Returns a random real in [0,1).
-    return rand() / (RAND_MAX + 1.0);
+    return unit_real(rng.next_uint());
 }
 
-inline double random_double(double min, double max) {
+inline real random_real(real min, real max, pcg32& rng) {
     // Returns a random real in [min,max).
-    return min + (max-min)*random_double();
+    return min + (max-min)*random_real(rng);
 }
 
-inline double clamp(double x, double min, double max){
+inline real clamp(real x, real min, real max){
     if (x < min) return min;
     if (x > max) return max;
     return x;
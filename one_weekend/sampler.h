@@ -0,0 +1,300 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include "rtweekend.h"
+#include "sampler_type.h"
+
+#include <algorithm>
+#include <cstdint>
+
+// Low-discrepancy samplers index their points by (pixel, sample, dimension),
+// so every dimension has to mean the same thing in every sample of a pixel.
+// The mappings below turn a fixed number of uniform numbers into a point,
+// where rejection sampling would take a varying number.
+
+// Uniform point on the unit disk in the xy plane, by the concentric mapping
+// (Shirley and Chiu 1997), which keeps strata compact
+inline vec3 square_to_disk(real u, real v) {
+    real a = 2*u - 1, b = 2*v - 1;
+    if (a == 0 && b == 0)
+        return vec3(0,0,0);
+    real r, phi;
+    if (fabs(a) > fabs(b)) {
+        r = a;
+        phi = (pi/4) * (b/a);
+    } else {
+        r = b;
+        phi = (pi/2) - (pi/4) * (a/b);
+    }
+    return vec3(r * cos(phi), r * sin(phi), 0);
+}
+
+// Uniform direction, as random_unit_vector
+inline vec3 square_to_sphere(real u, real v) {
+    real z = 1 - 2*u;
+    real r = sqrt(fmax(0, 1 - z*z));
+    real phi = 2*pi*v;
+    return vec3(r * cos(phi), r * sin(phi), z);
+}
+
+// Uniform point in the unit ball, as random_in_unit_sphere
+inline vec3 cube_to_ball(real u, real v, real w) {
+    return cbrt(w) * square_to_sphere(u, v);
+}
+
+inline uint32_t reverse_bits(uint32_t x) {
+    x = __builtin_bswap32(x);
+    x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+    x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+    x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+    return x;
+}
+
+// Hash of Laine and Karras as improved by Burley (2020), in which every bit
+// of x depends only on the bits below it. Applied to a bit-reversed fraction
+// it is an Owen scrambling.
+inline uint32_t laine_karras_permutation(uint32_t x, uint32_t seed) {
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+// Owen scrambling of x read as the fraction 0.b31 b30 ... b0: every bit is
+// flipped depending only on the bits above it
+inline uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed) {
+    return reverse_bits(laine_karras_permutation(reverse_bits(x), seed));
+}
+
+// Dimension 0 or 1 of point index of the Sobol sequence, as a 32-bit fraction
+// with its bits reversed, the order Owen scrambling works in. Dimension 0 is
+// index itself, dimension 1 the product of the Pascal matrix with it;
+// together they are a (0,2)-sequence. The product is the xor of one table
+// entry per byte of index.
+inline uint32_t reversed_sobol_2d(uint32_t index, int dimension) {
+    if (dimension == 0)
+        return index;
+    static const struct table {
+        uint32_t columns[4][256];
+        table() {
+            uint32_t v[32];
+            v[0] = 1u << 31;
+            for (int k = 1; k < 32; k++)
+                v[k] = v[k - 1] ^ (v[k - 1] >> 1);
+            for (int b = 0; b < 4; b++)
+                for (int byte = 0; byte < 256; byte++) {
+                    columns[b][byte] = 0;
+                    for (int k = 0; k < 8; k++)
+                        if ((byte >> k) & 1)
+                            columns[b][byte] ^= reverse_bits(v[8*b + k]);
+                }
+        }
+    } pascal;
+    return pascal.columns[0][index & 0xff] ^ pascal.columns[1][(index >> 8) & 0xff]
+         ^ pascal.columns[2][(index >> 16) & 0xff] ^ pascal.columns[3][index >> 24];
+}
+
+// Random permutation of [0, length) indexed by seed, evaluated at i
+// (Kensler 2013, "Correlated Multi-Jittered Sampling")
+inline uint32_t permute(uint32_t i, uint32_t length, uint32_t seed) {
+    uint32_t w = length - 1;
+    w |= w >> 1;
+    w |= w >> 2;
+    w |= w >> 4;
+    w |= w >> 8;
+    w |= w >> 16;
+    do {
+        i ^= seed;
+        i *= 0xe170893d;
+        i ^= seed >> 16;
+        i ^= (i & w) >> 4;
+        i ^= seed >> 8;
+        i *= 0x0929eb3f;
+        i ^= seed >> 23;
+        i ^= (i & w) >> 1;
+        i *= 1 | seed >> 27;
+        i *= 0x6935fa69;
+        i ^= (i & w) >> 11;
+        i *= 0x74dcb303;
+        i ^= (i & w) >> 2;
+        i *= 0x9e501cc3;
+        i ^= (i & w) >> 2;
+        i *= 0xc860a3df;
+        i &= w;
+        i ^= i >> 5;
+    } while (i >= length);
+    return (i + seed) % length;
+}
+
+// Fraction in [0,1) as the 32-bit fixed point number random_real reads
+inline uint32_t fraction_bits(double f) {
+    return static_cast<uint32_t>(std::min(f * 4294967296.0, 4294967295.0));
+}
+
+// Bases of the Halton dimensions: the first halton_dimensions primes
+const int halton_dimensions = 256;
+
+inline const uint32_t* halton_bases() {
+    static const struct table {
+        uint32_t primes[halton_dimensions];
+        table() {
+            int n = 0;
+            for (uint32_t p = 2; n < halton_dimensions; p++) {
+                bool prime = true;
+                for (int k = 0; k < n && primes[k] * primes[k] <= p; k++)
+                    prime = prime && p % primes[k] != 0;
+                if (prime)
+                    primes[n++] = p;
+            }
+        }
+    } bases;
+    return bases.primes;
+}
+
+// Radical inverse of index in base, with every digit Owen scrambled: it is
+// permuted by a permutation that depends on the seed, its position and the
+// digits below it. The permutations are the linear ones, a*digit + c modulo
+// the prime base (Matousek 1998), which are cheap to draw. Past the last
+// nonzero digit the scrambled zeros are just a uniform point of the interval
+// left, so small indices in large bases still spread over [0,1).
+inline double scrambled_radical_inverse(uint32_t base, uint32_t index, uint32_t seed) {
+    double inverse = 1.0 / base, f = 1, r = 0;
+    uint64_t prefix = 0;
+    for (int k = 0; ; k++) {
+        uint64_t digit_seed = hash_uint64((uint64_t(seed) << 32 | k) ^ (prefix * 0x9e3779b97f4a7c15ULL));
+        if (index == 0)
+            return r + f * unit_real(static_cast<uint32_t>(digit_seed >> 32));
+        uint32_t digit = index % base;
+        index /= base;
+        f *= inverse;
+        uint32_t a = 1 + static_cast<uint32_t>(digit_seed) % (base - 1);
+        uint32_t c = static_cast<uint32_t>(digit_seed >> 32) % base;
+        r += f * ((uint64_t(a) * digit + c) % base);
+        prefix = prefix * base + digit;
+    }
+}
+
+/**
+** The numbers of one sample of one pixel, one dimension after the other.
+** Dimensions 0-1 jitter the point in the pixel and 2-3 pick the point on the
+** lens. Every bounce then owns bounce_dimensions: the scatter draws from the
+** first four, the light sample from the next three and Russian roulette from
+** the last, so that a dimension means the same thing in every sample of a
+** pixel whatever the materials hit.
+** Plain data, small enough to travel with every path of a queue.
+*/
+class sample_stream {
+    public:
+        static const int camera_dimensions = 4;
+        static const int bounce_dimensions = 8;
+
+        sample_stream() {}      // Unset, for arrays that are assigned later
+
+        sample_stream(sampler_type type, int strata, uint64_t pixel, uint32_t index)
+            : pixel_key(hash_uint64(pixel)), index(index), dimension(0),
+              strata(strata), type(type), sobol_pair(~0u)
+        {
+            if (type == sampler_type::random)
+                rng = sample_rng(pixel, index);
+        }
+
+        // The number of the next dimension
+        real next() {
+            uint32_t d = dimension++;
+            switch (type) {
+                case sampler_type::random:     return random_real(rng);
+                case sampler_type::stratified: return unit_real(stratified(d));
+                case sampler_type::halton:     return unit_real(halton(d));
+                default:                       return unit_real(sobol(d));
+            }
+        }
+
+        // Moves on to the scatter dimensions of a bounce
+        void start_bounce(int bounce) {
+            dimension = camera_dimensions + bounce * bounce_dimensions;
+        }
+
+        // Moves on to the dimensions of the light sample of a bounce: a point
+        // on the light, then the light
+        void start_light(int bounce) {
+            dimension = camera_dimensions + bounce * bounce_dimensions + 4;
+        }
+
+        // Number for the Russian roulette played after a bounce
+        real roulette(int bounce) {
+            dimension = camera_dimensions + (bounce + 1) * bounce_dimensions - 1;
+            return next();
+        }
+
+    private:
+        // Uncorrelated bits for dimension d, for the dimensions a sampler
+        // does not cover
+        uint32_t hashed(uint32_t d, uint64_t salt = 0) const {
+            return static_cast<uint32_t>(hash_uint64(pixel_key ^ hash_uint64((uint64_t(index) << 32 | d) ^ salt)) >> 32);
+        }
+
+        uint32_t seed(uint32_t d) const {
+            return static_cast<uint32_t>(hash_uint64(pixel_key + d));
+        }
+
+        // The samples of a pixel go in blocks of strata, the samples it takes
+        // at once. Sample i falls in stratum permute(i % strata) of its block,
+        // with the permutation drawn anew for every pixel, dimension and
+        // block, so every block that is taken whole is stratified.
+        uint32_t stratified(uint32_t d) const {
+            uint32_t block = index / strata;
+            uint32_t block_seed = static_cast<uint32_t>(hash_uint64(pixel_key + d + (uint64_t(block) << 32)));
+            uint32_t stratum = permute(index % strata, strata, block_seed);
+            real jitter = unit_real(hashed(d, 1));
+            return fraction_bits((stratum + jitter) / strata);
+        }
+
+        // Halton point, Owen scrambled per pixel and dimension
+        uint32_t halton(uint32_t d) const {
+            if (d >= static_cast<uint32_t>(halton_dimensions))
+                return hashed(d);
+            return fraction_bits(scrambled_radical_inverse(halton_bases()[d], index, seed(d)));
+        }
+
+        // Pairs of dimensions share a 2D Sobol pattern, whose points are
+        // shuffled by an Owen scrambling of their index that differs from one
+        // pair to the next, and each coordinate is Owen scrambled in turn
+        // (Burley 2020, "Practical Hash-based Owen Scrambling"). Dimensions
+        // are mostly drawn in pairs, so the shuffled index of the last pair is
+        // kept.
+        uint32_t sobol(uint32_t d) {
+            if (d >> 1 != sobol_pair) {
+                uint64_t pair_seeds = hash_uint64(pixel_key + (d >> 1));
+                sobol_pair = d >> 1;
+                sobol_index = nested_uniform_scramble(index, static_cast<uint32_t>(pair_seeds));
+                sobol_seed = static_cast<uint32_t>(pair_seeds >> 32);
+            }
+            uint32_t coordinate_seed = sobol_seed ^ (d & 1 ? 0x5bd1e995u : 0);
+            return reverse_bits(laine_karras_permutation(reversed_sobol_2d(sobol_index, d & 1), coordinate_seed));
+        }
+
+    private:
+        pcg32 rng;              // Draws of the random sampler, in order
+        uint64_t pixel_key;
+        uint32_t index;         // Of the sample in its pixel
+        uint32_t dimension;
+        int strata;             // Block size of the stratified sampler
+        sampler_type type;
+        uint32_t sobol_pair;    // Pair of dimensions sobol_index and sobol_seed belong to
+        uint32_t sobol_index;
+        uint32_t sobol_seed;
+};
+
+// Starts the sample streams of a render
+struct sampler {
+    sampler_type type;
+    int strata;         // Samples a pixel takes at once, see sample_stream::stratified
+
+    sample_stream start(uint64_t pixel, uint32_t index) const {
+        return sample_stream(type, strata, pixel, index);
+    }
+};
+
+#endif
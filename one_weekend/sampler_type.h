@@ -0,0 +1,31 @@
+#ifndef SAMPLER_TYPE_H
+#define SAMPLER_TYPE_H
+
+#include <cstring>
+
+enum class sampler_type {
+    random,         // Independent PCG32 draws
+    stratified,     // Jittered strata, shuffled per pixel and dimension
+    halton,         // Owen-scrambled Halton sequence
+    sobol           // Owen-scrambled Sobol (0,2)-sequence, padded by shuffling
+};
+
+inline bool parse_sampler_type(const char* name, sampler_type& type) {
+    if (!strcmp(name, "random")) type = sampler_type::random;
+    else if (!strcmp(name, "stratified")) type = sampler_type::stratified;
+    else if (!strcmp(name, "halton")) type = sampler_type::halton;
+    else if (!strcmp(name, "sobol")) type = sampler_type::sobol;
+    else return false;
+    return true;
+}
+
+inline const char* sampler_type_name(sampler_type type) {
+    switch (type) {
+        case sampler_type::random:     return "random";
+        case sampler_type::stratified: return "stratified";
+        case sampler_type::halton:     return "halton";
+        default:                       return "sobol";
+    }
+}
+
+#endif
@@ -0,0 +1,254 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include "rtweekend.h"
+
+#include "material.h"
+#include "primitive_store.h"
+#include "light.h"
+#include "hittable_list.h"
+#include "triangle_mesh.h"
+#include "obj_loader.h"
+#include "instance.h"
+#include "transform.h"
+
+#include <string>
+#include <vector>
+
+// A scene as plain values: render settings, camera, materials and geometry.
+// It is generated by random_scene or read from a scene file (see
+// scene_file.h), and build_scene turns it into what the integrators trace.
+
+struct camera_settings {
+    point3 lookfrom = point3(13,2,3);
+    point3 lookat = point3(0,0,0);
+    vec3 vup = vec3(0,1,0);
+    real vfov = 20;             // Vertical field of view in degrees
+    real aperture = 0.1;
+    real focus_dist = 10;
+};
+
+struct material_desc {
+    material_type type;
+    color albedo;               // lambertian and metal, or what a diffuse_light emits
+    real fuzz;                  // metal
+    real ir;                    // dielectric index of refraction
+};
+
+inline material_desc lambertian_material(const color& albedo) {
+    return { material_type::lambertian, albedo, 0, 0 };
+}
+
+inline material_desc metal_material(const color& albedo, real fuzz) {
+    return { material_type::metal, albedo, fuzz, 0 };
+}
+
+inline material_desc dielectric_material(real ir) {
+    return { material_type::dielectric, color(1,1,1), 0, ir };
+}
+
+inline material_desc diffuse_light_material(const color& emit) {
+    return { material_type::diffuse_light, emit, 0, 0 };
+}
+
+// Objects refer to their material by its index in scene_desc::materials
+struct sphere_desc {
+    point3 center;
+    real radius;
+    int material;
+};
+
+struct triangle_desc {
+    point3 a, b, c;
+    int material;
+};
+
+// Wavefront OBJ mesh, read when the scene is built
+struct obj_desc {
+    std::string path;
+    int material;
+};
+
+// Copy of an asset, a Wavefront OBJ mesh that is only drawn through its
+// instances, under a transform and with a material of its own
+struct instance_desc {
+    int asset;                  // Index in scene_desc::assets
+    int material;
+    affine transform;
+};
+
+// Rigid motion of an instance, per frame of a sequence: a turn about the
+// axis through the instance's origin, then a translation
+struct motion_desc {
+    int instance;               // Index in scene_desc::instances
+    vec3 velocity;
+    vec3 axis;
+    real degrees;
+};
+
+struct scene_desc {
+    // Render settings
+    int image_width = 1200;
+    real aspect_ratio = 1.5;
+    int samples_per_pixel = 100;
+    int max_depth = 50;
+
+    camera_settings camera;
+    real orbit = 0;             // Degrees per frame the camera turns about vup around lookat
+    bool has_background = false;
+    color background;           // Of rays that escape, instead of the sky gradient
+
+    std::vector<material_desc> materials;
+    std::vector<sphere_desc> spheres;
+    std::vector<triangle_desc> triangles;
+    std::vector<obj_desc> meshes;
+    std::vector<std::string> assets;
+    std::vector<instance_desc> instances;
+    std::vector<motion_desc> motions;
+
+    int image_height() const { return static_cast<int>(image_width / aspect_ratio); }
+
+    int add_material(const material_desc& m) {
+        materials.push_back(m);
+        return static_cast<int>(materials.size()) - 1;
+    }
+};
+
+// The final scene of the book: a ground sphere, three large spheres and a
+// grid of small random ones for a and b in [-grid, grid), plus a metal
+// triangle. grid = 11 is the scene of the book.
+scene_desc random_scene(int grid) {
+    scene_desc scene;
+    pcg32 rng;
+
+    int ground_material = scene.add_material(lambertian_material(color(0.5, 0.5, 0.5)));
+    scene.spheres.push_back({ point3(0,-1000,0), 1000, ground_material });
+
+    for (int a = -grid; a < grid; a++) {
+        for (int b = -grid; b < grid; b++) {
+            auto choose_mat = random_real(rng);
+            real center_x = a + 0.9*random_real(rng);
+            point3 center(center_x, 0.2, b + 0.9*random_real(rng));
+
+            if ((center - point3(4, 0.2, 0)).length() > 0.9) {
+                int sphere_material;
+
+                if (choose_mat < 0.8) {
+                    // diffuse
+                    auto albedo = color::random(rng);
+                    albedo = albedo * color::random(rng);
+                    sphere_material = scene.add_material(lambertian_material(albedo));
+                } else if (choose_mat < 0.95) {
+                    // metal
+                    auto albedo = color::random(0.5, 1, rng);
+                    auto fuzz = random_real(0, 0.5, rng);
+                    sphere_material = scene.add_material(metal_material(albedo, fuzz));
+                } else {
+                    // glass
+                    sphere_material = scene.add_material(dielectric_material(1.5));
+                }
+                scene.spheres.push_back({ center, 0.2, sphere_material });
+            }
+        }
+    }
+
+    int material1 = scene.add_material(dielectric_material(1.5));
+    scene.spheres.push_back({ point3(0, 1, 0), 1.0, material1 });
+
+    int material2 = scene.add_material(lambertian_material(color(0.4, 0.2, 0.1)));
+    scene.spheres.push_back({ point3(-4, 1, 0), 1.0, material2 });
+
+    int material3 = scene.add_material(metal_material(color(0.7, 0.6, 0.5), 0.0));
+    scene.spheres.push_back({ point3(4, 1, 0), 1.0, material3 });
+
+    int material_metal = scene.add_material(metal_material(color(0.8, 0.6, 0.2), 1.0));
+    scene.triangles.push_back({ point3(0.25,0,-1), point3(0.125,0.5,-1.25), point3(0,0,-2), material_metal });
+
+    return scene;
+}
+
+// A scene ready to trace. world holds primitives, the meshes and the
+// instances, if any, which may be built from a scene_desc or mapped from a
+// geometry cache. lights lists the emissive primitives for light sampling.
+struct scene_world {
+    material_table materials;
+    shared_ptr<primitive_store> primitives;
+    std::vector<shared_ptr<triangle_mesh>> meshes;
+    shared_ptr<instance_group> instances;   // Prototypes are the meshes of the assets
+    hittable_list world;
+    scene_lights lights;
+};
+
+// Adds the materials of a scene to the table, returning them by index
+std::vector<const material*> add_materials(const scene_desc& scene, material_table& materials) {
+    std::vector<const material*> table(scene.materials.size());
+    for (size_t k = 0; k < scene.materials.size(); k++) {
+        const material_desc& m = scene.materials[k];
+        switch (m.type) {
+            case material_type::lambertian: table[k] = materials.add<lambertian>(m.albedo); break;
+            case material_type::metal:      table[k] = materials.add<metal>(m.albedo, m.fuzz); break;
+            case material_type::dielectric: table[k] = materials.add<dielectric>(m.ir); break;
+            case material_type::diffuse_light: table[k] = materials.add<diffuse_light>(m.albedo); break;
+        }
+    }
+    return table;
+}
+
+// Builds the materials and objects of a scene into out: spheres and
+// triangles by value into one primitive_store, each OBJ mesh as a
+// triangle_mesh and all instances into one instance_group, with one mesh
+// per asset. Returns false with failed_obj set to the path of an OBJ file
+// that cannot be read.
+bool build_scene(const scene_desc& scene, scene_world& out, const char*& failed_obj) {
+    std::vector<const material*> table = add_materials(scene, out.materials);
+
+    out.primitives = make_shared<primitive_store>();
+    for (const material* m : table)
+        out.primitives->add_material(m);
+    for (const sphere_desc& s : scene.spheres)
+        out.primitives->add_sphere(s.center, s.radius, s.material);
+    for (const triangle_desc& t : scene.triangles)
+        out.primitives->add_triangle(t.a, t.b, t.c, t.material);
+
+    // Acceleration structures over the whole scene
+    out.primitives->build();
+    out.world.add(out.primitives);
+    out.lights.has_background = scene.has_background;
+    out.lights.background = scene.background;
+    out.lights.collect(*out.primitives);
+
+    for (const obj_desc& m : scene.meshes) {
+        std::vector<point3> vertices;
+        std::vector<int> indices;
+        if (!load_obj(m.path.c_str(), vertices, indices)) {
+            failed_obj = m.path.c_str();
+            return false;
+        }
+        out.meshes.push_back(make_shared<triangle_mesh>(std::move(vertices), std::move(indices), table[m.material]));
+        out.world.add(out.meshes.back());
+    }
+
+    if (scene.instances.empty())
+        return true;
+
+    out.instances = make_shared<instance_group>();
+    for (const material* m : table)
+        out.instances->add_material(m);
+    for (const std::string& path : scene.assets) {
+        std::vector<point3> vertices;
+        std::vector<int> indices;
+        if (!load_obj(path.c_str(), vertices, indices)) {
+            failed_obj = path.c_str();
+            return false;
+        }
+        out.instances->add_prototype(make_shared<triangle_mesh>(std::move(vertices), std::move(indices), nullptr));
+    }
+    for (const instance_desc& i : scene.instances)
+        out.instances->add(i.asset, i.transform, i.material);
+    out.instances->build();
+    out.world.add(out.instances);
+
+    return true;
+}
+
+#endif
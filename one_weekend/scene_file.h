@@ -0,0 +1,382 @@
+#ifndef SCENE_FILE_H
+#define SCENE_FILE_H
+
+#include "rtweekend.h"
+#include "scene.h"
+#include "line_reader.h"
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+// Scene files are text, one statement per line; '#' starts a comment.
+//
+//   image_width N
+//   aspect_ratio R
+//   samples_per_pixel N
+//   max_depth N
+//   camera LOOKFROM LOOKAT VUP VFOV APERTURE FOCUS_DIST   (points are x y z)
+//   lambertian R G B
+//   metal R G B FUZZ
+//   dielectric IR
+//   diffuse_light R G B
+//   sphere X Y Z RADIUS MATERIAL
+//   triangle AX AY AZ BX BY BZ CX CY CZ MATERIAL
+//   obj PATH MATERIAL
+//   asset PATH
+//   instance ASSET MATERIAL TRANSFORM...
+//   motion INSTANCE VX VY VZ AXIS_X AXIS_Y AXIS_Z DEGREES
+//   orbit DEGREES
+//   background R G B
+//
+// Materials are numbered from 0 in the order they appear, and an object can
+// only use a material declared above it. Settings left out keep the
+// defaults of scene_desc. An asset is an OBJ mesh that is only drawn through
+// its instances; assets are numbered like materials. The transform of an
+// instance is any sequence of
+//
+//   translate X Y Z
+//   rotate AXIS_X AXIS_Y AXIS_Z DEGREES
+//   scale S  or  scale X Y Z
+//   matrix M00 M01 M02 M03 M10 ... M23     (rows of a 3x4 matrix)
+//
+// applied in the order written, to the asset as it is in its file.
+//
+// Sequences of frames are animated by motions, which move and turn an
+// instance by the given amounts at every frame, and by orbit, which turns
+// the camera about vup around lookat.
+//
+// A diffuse_light emits the given color from the front of what it is on:
+// the outside of a sphere, and the side of a triangle from which A, B and C
+// run counterclockwise. Spheres and triangles that emit are sampled as
+// lights. Rays that escape see the sky gradient of the book, or the
+// background color when one is set; a black background leaves the lights
+// as the only source.
+
+// Reads count reals at p and moves p past them
+inline bool parse_reals(char*& p, real* out, int count) {
+    for (int k = 0; k < count; k++) {
+        char* next;
+        out[k] = strtod(p, &next);
+        if (next == p)
+            return false;
+        p = next;
+    }
+    return true;
+}
+
+inline bool parse_int(char*& p, int& out) {
+    char* next;
+    long value = strtol(p, &next, 10);
+    if (next == p)
+        return false;
+    out = static_cast<int>(value);
+    p = next;
+    return true;
+}
+
+inline bool parse_point(char*& p, point3& out) {
+    real e[3];
+    if (!parse_reals(p, e, 3))
+        return false;
+    out = point3(e[0], e[1], e[2]);
+    return true;
+}
+
+// Nul-terminates the word at p and moves p past it
+inline char* parse_word(char*& p) {
+    while (isspace(static_cast<unsigned char>(*p)))
+        p++;
+    char* word = p;
+    while (*p != '\0' && !isspace(static_cast<unsigned char>(*p)))
+        p++;
+    if (*p != '\0')
+        *p++ = '\0';
+    return word;
+}
+
+// Whether the word at p is keyword, in which case p moves past it
+inline bool parse_keyword(char*& p, const char* keyword) {
+    size_t n = strlen(keyword);
+    if (strncmp(p, keyword, n) != 0 || !(isspace(static_cast<unsigned char>(p[n])) || p[n] == '\0'))
+        return false;
+    p += n;
+    return true;
+}
+
+inline bool at_line_end(const char* p) {
+    while (isspace(static_cast<unsigned char>(*p)))
+        p++;
+    return *p == '\0';
+}
+
+// Reads the transform of an instance up to the end of the line
+inline bool parse_transform(char*& p, affine& transform) {
+    transform = affine();
+    while (!at_line_end(p)) {
+        while (isspace(static_cast<unsigned char>(*p)))
+            p++;
+        affine step;
+        real e[12];
+        if (parse_keyword(p, "translate")) {
+            if (!parse_reals(p, e, 3))
+                return false;
+            step = affine::translation(vec3(e[0], e[1], e[2]));
+        } else if (parse_keyword(p, "rotate")) {
+            if (!parse_reals(p, e, 4) || vec3(e[0], e[1], e[2]).near_zero())
+                return false;
+            step = affine::rotation(vec3(e[0], e[1], e[2]), e[3]);
+        } else if (parse_keyword(p, "scale")) {
+            if (!parse_reals(p, e, 1))
+                return false;
+            char* rest = p;
+            if (parse_reals(rest, e + 1, 2))
+                p = rest;
+            else
+                e[1] = e[2] = e[0];
+            step = affine::scaling(vec3(e[0], e[1], e[2]));
+        } else if (parse_keyword(p, "matrix")) {
+            if (!parse_reals(p, e, 12))
+                return false;
+            step = affine(vec3(e[0], e[1], e[2]), vec3(e[4], e[5], e[6]), vec3(e[8], e[9], e[10]),
+                          vec3(e[3], e[7], e[11]));
+        } else {
+            return false;
+        }
+        transform = step * transform;
+    }
+
+    // Singular transforms have no inverse to take rays to the asset
+    return transform.determinant() != 0;
+}
+
+// Parses one line of a scene file into scene, see load_scene
+inline bool parse_scene_line(char* line, scene_desc& scene) {
+    if (char* comment = strchr(line, '#'))
+        *comment = '\0';
+    while (isspace(static_cast<unsigned char>(*line)))
+        line++;
+    if (*line == '\0')
+        return true;
+
+    char* p = line;
+    int material_count = static_cast<int>(scene.materials.size());
+    auto parse_material = [&](int& index) {
+        return parse_int(p, index) && index >= 0 && index < material_count;
+    };
+
+    // Most common first
+    if (parse_keyword(p, "sphere")) {
+        sphere_desc s;
+        if (!parse_point(p, s.center) || !parse_reals(p, &s.radius, 1) || !parse_material(s.material))
+            return false;
+        scene.spheres.push_back(s);
+    } else if (parse_keyword(p, "triangle")) {
+        triangle_desc t;
+        if (!parse_point(p, t.a) || !parse_point(p, t.b) || !parse_point(p, t.c) || !parse_material(t.material))
+            return false;
+        scene.triangles.push_back(t);
+    } else if (parse_keyword(p, "lambertian")) {
+        point3 albedo;
+        if (!parse_point(p, albedo))
+            return false;
+        scene.add_material(lambertian_material(albedo));
+    } else if (parse_keyword(p, "metal")) {
+        point3 albedo;
+        real fuzz;
+        if (!parse_point(p, albedo) || !parse_reals(p, &fuzz, 1))
+            return false;
+        scene.add_material(metal_material(albedo, fuzz));
+    } else if (parse_keyword(p, "dielectric")) {
+        real ir;
+        if (!parse_reals(p, &ir, 1))
+            return false;
+        scene.add_material(dielectric_material(ir));
+    } else if (parse_keyword(p, "diffuse_light")) {
+        point3 emit;
+        if (!parse_point(p, emit))
+            return false;
+        scene.add_material(diffuse_light_material(emit));
+    } else if (parse_keyword(p, "instance")) {
+        instance_desc i;
+        if (!parse_int(p, i.asset) || i.asset < 0 || i.asset >= static_cast<int>(scene.assets.size())
+            || !parse_material(i.material) || !parse_transform(p, i.transform))
+            return false;
+        scene.instances.push_back(i);
+    } else if (parse_keyword(p, "motion")) {
+        motion_desc m;
+        if (!parse_int(p, m.instance) || m.instance < 0 || m.instance >= static_cast<int>(scene.instances.size())
+            || !parse_point(p, m.velocity) || !parse_point(p, m.axis) || !parse_reals(p, &m.degrees, 1)
+            || (m.degrees != 0 && m.axis.near_zero()))
+            return false;
+        scene.motions.push_back(m);
+    } else if (parse_keyword(p, "orbit")) {
+        if (!parse_reals(p, &scene.orbit, 1))
+            return false;
+    } else if (parse_keyword(p, "background")) {
+        if (!parse_point(p, scene.background))
+            return false;
+        scene.has_background = true;
+    } else if (parse_keyword(p, "obj")) {
+        obj_desc m;
+        m.path = parse_word(p);
+        if (m.path.empty() || !parse_material(m.material))
+            return false;
+        scene.meshes.push_back(m);
+    } else if (parse_keyword(p, "asset")) {
+        char* path = parse_word(p);
+        if (*path == '\0')
+            return false;
+        scene.assets.push_back(path);
+    } else if (parse_keyword(p, "camera")) {
+        camera_settings& c = scene.camera;
+        if (!parse_point(p, c.lookfrom) || !parse_point(p, c.lookat) || !parse_point(p, c.vup)
+            || !parse_reals(p, &c.vfov, 1) || !parse_reals(p, &c.aperture, 1) || !parse_reals(p, &c.focus_dist, 1))
+            return false;
+    } else if (parse_keyword(p, "image_width")) {
+        if (!parse_int(p, scene.image_width) || scene.image_width <= 0)
+            return false;
+    } else if (parse_keyword(p, "aspect_ratio")) {
+        if (!parse_reals(p, &scene.aspect_ratio, 1) || !(scene.aspect_ratio > 0))
+            return false;
+    } else if (parse_keyword(p, "samples_per_pixel")) {
+        if (!parse_int(p, scene.samples_per_pixel) || scene.samples_per_pixel <= 0)
+            return false;
+    } else if (parse_keyword(p, "max_depth")) {
+        if (!parse_int(p, scene.max_depth) || scene.max_depth <= 0)
+            return false;
+    } else {
+        return false;
+    }
+
+    return at_line_end(p);
+}
+
+// Reads a scene file in one pass with read_lines. Objects go straight into
+// the arrays of scene, without an allocation of their own. Returns false if
+// the file cannot be read, with error_line 0, or on the first malformed
+// line, with error_line set to its number.
+bool load_scene(const char* path, scene_desc& scene, int& error_line) {
+    scene = scene_desc();
+    int line_number = 0;
+    error_line = 0;
+    bool ok = read_lines(path, [&](char* line) {
+        line_number++;
+        return parse_scene_line(line, scene);
+    });
+
+    if (!ok && line_number > 0)
+        error_line = line_number;
+    return ok;
+}
+
+// Writes scene in the format load_scene reads, with enough digits that
+// reading it back gives the same values.
+bool save_scene(const char* path, const scene_desc& scene) {
+    FILE* file = fopen(path, "w");
+    if (!file)
+        return false;
+
+    const int digits = std::numeric_limits<real>::max_digits10;
+    auto point = [&](const point3& v) {
+        fprintf(file, " %.*g %.*g %.*g", digits, double(v.x()), digits, double(v.y()), digits, double(v.z()));
+    };
+    auto number = [&](real x) {
+        fprintf(file, " %.*g", digits, double(x));
+    };
+
+    fprintf(file, "image_width %d\naspect_ratio", scene.image_width);
+    number(scene.aspect_ratio);
+    fprintf(file, "\nsamples_per_pixel %d\nmax_depth %d\n", scene.samples_per_pixel, scene.max_depth);
+
+    const camera_settings& c = scene.camera;
+    fprintf(file, "camera");
+    point(c.lookfrom);
+    point(c.lookat);
+    point(c.vup);
+    number(c.vfov);
+    number(c.aperture);
+    number(c.focus_dist);
+    fprintf(file, "\n");
+
+    for (const material_desc& m : scene.materials) {
+        switch (m.type) {
+            case material_type::lambertian:
+                fprintf(file, "lambertian");
+                point(m.albedo);
+                break;
+            case material_type::metal:
+                fprintf(file, "metal");
+                point(m.albedo);
+                number(m.fuzz);
+                break;
+            case material_type::dielectric:
+                fprintf(file, "dielectric");
+                number(m.ir);
+                break;
+            case material_type::diffuse_light:
+                fprintf(file, "diffuse_light");
+                point(m.albedo);
+                break;
+        }
+        fprintf(file, "\n");
+    }
+
+    for (const sphere_desc& s : scene.spheres) {
+        fprintf(file, "sphere");
+        point(s.center);
+        number(s.radius);
+        fprintf(file, " %d\n", s.material);
+    }
+
+    for (const triangle_desc& t : scene.triangles) {
+        fprintf(file, "triangle");
+        point(t.a);
+        point(t.b);
+        point(t.c);
+        fprintf(file, " %d\n", t.material);
+    }
+
+    for (const obj_desc& m : scene.meshes)
+        fprintf(file, "obj %s %d\n", m.path.c_str(), m.material);
+
+    for (const std::string& path : scene.assets)
+        fprintf(file, "asset %s\n", path.c_str());
+
+    for (const instance_desc& i : scene.instances) {
+        const affine& m = i.transform;
+        fprintf(file, "instance %d %d matrix", i.asset, i.material);
+        for (int r = 0; r < 3; r++) {
+            point(m.row[r]);
+            number(m.offset[r]);
+        }
+        fprintf(file, "\n");
+    }
+
+    for (const motion_desc& m : scene.motions) {
+        fprintf(file, "motion %d", m.instance);
+        point(m.velocity);
+        point(m.axis);
+        number(m.degrees);
+        fprintf(file, "\n");
+    }
+
+    if (scene.orbit != 0) {
+        fprintf(file, "orbit");
+        number(scene.orbit);
+        fprintf(file, "\n");
+    }
+
+    if (scene.has_background) {
+        fprintf(file, "background");
+        point(scene.background);
+        fprintf(file, "\n");
+    }
+
+    bool ok = !ferror(file);
+    return fclose(file) == 0 && ok;
+}
+
+#endif
@@ -7,31 +7,36 @@
 class sphere : public hittable {
     public:
         sphere() {}
-        sphere(point3 cen, double r, shared_ptr<material> m) : center(cen), radius(r), mat_ptr(m) {};
+        sphere(point3 cen, real r, const material* m) : center(cen), radius(r), mat_ptr(m) {};
 
-        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec)
+        virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec)
+            const override;
+
+        virtual bool bounding_box(aabb& output_box) const override;
+
+        virtual int hit_packet(const ray_packet& r, real t_min, preal& t_max, hit_record* rec, int active)
             const override;
 
     public:
         point3 center;
-        double radius;
-        shared_ptr<material> mat_ptr;
+        real radius;
+        const material* mat_ptr;
 };
 
-bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+bool sphere::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
     vec3 A_C = r.origin() - center;
 
-    double a = r.direction().length_squared();
-    double half_b = dot(r.direction(), A_C);
-    double c = A_C.length_squared() - radius * radius;
+    real a = r.direction().length_squared();
+    real half_b = dot(r.direction(), A_C);
+    real c = A_C.length_squared() - radius * radius;
 
-    double quarter_discriminant = half_b*half_b - a*c;
+    real quarter_discriminant = half_b*half_b - a*c;
     if (quarter_discriminant < 0)
         return false;
-    double sqrt_quarter_discriminant = sqrt(quarter_discriminant);
+    real sqrt_quarter_discriminant = sqrt(quarter_discriminant);
 
     // Find the nearest root that lies in the acceptable range
-    double root = (-half_b - sqrt_quarter_discriminant) / a;
+    real root = (-half_b - sqrt_quarter_discriminant) / a;
     if (root < t_min || root > t_max) {
         root = (-half_b + sqrt_quarter_discriminant) / a;
         if (root < t_min || root > t_max)
@@ -45,7 +50,57 @@ bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) cons
     rec.set_face_normal(r, outward_normal);
 
     rec.mat_ptr = mat_ptr;
-    
+    rec.light = -1;
+
+    return true;
+}
+
+int sphere::hit_packet(const ray_packet& r, real t_min, preal& t_max, hit_record* rec, int active) const {
+    pvec3 A_C = r.orig - pvec3(center);
+
+    preal a = dot(r.dir, r.dir);
+    preal half_b = dot(r.dir, A_C);
+    preal c = dot(A_C, A_C) - preal(radius * radius);
+
+    preal quarter_discriminant = half_b*half_b - a*c;
+    preal valid = preal::lane_mask(active) & (quarter_discriminant >= preal(0.0f));
+    if (!movemask(valid))
+        return 0;
+    preal sqrt_quarter_discriminant = sqrt(max(quarter_discriminant, preal(0.0f)));
+
+    // Nearest root in range per lane, the far one where the near one is out
+    preal root = (-half_b - sqrt_quarter_discriminant) / a;
+    preal near_in_range = (root >= preal(t_min)) & (root <= t_max);
+    root = select(near_in_range, root, (-half_b + sqrt_quarter_discriminant) / a);
+    valid = valid & (root >= preal(t_min)) & (root <= t_max);
+
+    int hits = movemask(valid);
+    if (!hits)
+        return 0;
+    t_max = select(valid, root, t_max);
+
+    alignas(32) real t[packet_width];
+    root.store(t);
+    for (int i = 0; i < packet_width; i++) {
+        if (!((hits >> i) & 1))
+            continue;
+
+        rec[i].t = t[i];
+        rec[i].p = r.rays[i].at(t[i]);
+
+        vec3 outward_normal = (rec[i].p - center) / radius;
+        rec[i].set_face_normal(r.rays[i], outward_normal);
+
+        rec[i].mat_ptr = mat_ptr;
+        rec[i].light = -1;
+    }
+
+    return hits;
+}
+
+bool sphere::bounding_box(aabb& output_box) const {
+    vec3 r(radius, radius, radius);
+    output_box = aabb(center - r, center + r);
     return true;
 }
 
@@ -0,0 +1,157 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads running batches of indexed tasks. Every thread
+// owns a task queue; it works from the front of its own queue and, once that
+// is empty, steals from the back of the others.
+class thread_pool {
+    public:
+        // thread_count 0 means one thread per hardware thread. The calling
+        // thread takes part in the work, so thread_count-1 workers are spawned.
+        explicit thread_pool(unsigned int thread_count = 0);
+        ~thread_pool();
+
+        thread_pool(const thread_pool&) = delete;
+        thread_pool& operator=(const thread_pool&) = delete;
+
+        unsigned int size() const { return thread_count; }
+
+        // Runs job(task, thread_index) for every task in [0, task_count) and
+        // returns once all of them are done. Consecutive tasks are dealt to the
+        // same queue so that neighbouring tiles tend to stay on one thread.
+        void parallel_for(int task_count, const std::function<void(int, int)>& job);
+
+    private:
+        struct alignas(64) work_queue {
+            std::mutex lock;
+            std::deque<int> tasks;
+        };
+
+        bool next_task(unsigned int thread_index, int& task);
+        void run_tasks(unsigned int thread_index);
+        void worker_loop(unsigned int thread_index);
+
+    private:
+        unsigned int thread_count;
+        std::unique_ptr<work_queue[]> queues;
+        std::vector<std::thread> workers;
+
+        const std::function<void(int, int)>* current_job = nullptr;
+        std::atomic<int> remaining_tasks{0};
+
+        std::mutex lock;
+        std::condition_variable wake_workers;
+        std::condition_variable batch_done;
+        unsigned long generation = 0;
+        bool stopping = false;
+};
+
+thread_pool::thread_pool(unsigned int thread_count) : thread_count(thread_count) {
+    if (this->thread_count == 0)
+        this->thread_count = std::max(1u, std::thread::hardware_concurrency());
+
+    queues.reset(new work_queue[this->thread_count]);
+    for (unsigned int i = 1; i < this->thread_count; i++)
+        workers.emplace_back(&thread_pool::worker_loop, this, i);
+}
+
+thread_pool::~thread_pool() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wake_workers.notify_all();
+    for (auto& worker : workers)
+        worker.join();
+}
+
+void thread_pool::parallel_for(int task_count, const std::function<void(int, int)>& job) {
+    if (task_count <= 0)
+        return;
+
+    current_job = &job;
+    remaining_tasks = task_count;
+
+    // Deal out contiguous chunks, one per queue
+    int chunk = (task_count + thread_count - 1) / thread_count;
+    for (unsigned int i = 0; i < thread_count; i++) {
+        std::lock_guard<std::mutex> guard(queues[i].lock);
+        for (int task = i * chunk; task < std::min(task_count, int(i + 1) * chunk); task++)
+            queues[i].tasks.push_back(task);
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        generation++;
+    }
+    wake_workers.notify_all();
+
+    run_tasks(0);
+
+    std::unique_lock<std::mutex> guard(lock);
+    batch_done.wait(guard, [this] { return remaining_tasks == 0; });
+}
+
+bool thread_pool::next_task(unsigned int thread_index, int& task) {
+    {
+        work_queue& own = queues[thread_index];
+        std::lock_guard<std::mutex> guard(own.lock);
+        if (!own.tasks.empty()) {
+            task = own.tasks.front();
+            own.tasks.pop_front();
+            return true;
+        }
+    }
+
+    for (unsigned int k = 1; k < thread_count; k++) {
+        work_queue& victim = queues[(thread_index + k) % thread_count];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.tasks.empty()) {
+            task = victim.tasks.back();
+            victim.tasks.pop_back();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void thread_pool::run_tasks(unsigned int thread_index) {
+    int task;
+    while (next_task(thread_index, task)) {
+        (*current_job)(task, thread_index);
+
+        if (--remaining_tasks == 0) {
+            std::lock_guard<std::mutex> guard(lock);
+            batch_done.notify_all();
+        }
+    }
+}
+
+void thread_pool::worker_loop(unsigned int thread_index) {
+    unsigned long seen_generation = 0;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            wake_workers.wait(guard, [&] { return stopping || generation != seen_generation; });
+            if (stopping)
+                return;
+            seen_generation = generation;
+        }
+
+        run_tasks(thread_index);
+    }
+}
+
+#endif
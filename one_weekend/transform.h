@@ -0,0 +1,84 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include "rtweekend.h"
+
+#include "aabb.h"
+
+// Affine transform x -> M x + offset, with M stored by rows. Plain data, so
+// that arrays of them can be cached and mapped.
+class affine {
+    public:
+        affine() : row{ vec3(1,0,0), vec3(0,1,0), vec3(0,0,1) }, offset(0,0,0) {}
+        affine(const vec3& r0, const vec3& r1, const vec3& r2, const vec3& t) : row{ r0, r1, r2 }, offset(t) {}
+
+        static affine translation(const vec3& t) { return affine(vec3(1,0,0), vec3(0,1,0), vec3(0,0,1), t); }
+
+        static affine scaling(const vec3& s) {
+            return affine(vec3(s.x(),0,0), vec3(0,s.y(),0), vec3(0,0,s.z()), vec3(0,0,0));
+        }
+
+        // Counterclockwise rotation about axis, looking down the axis
+        static affine rotation(const vec3& axis, real degrees) {
+            vec3 a = unit_vector(axis);
+            real theta = degrees_to_radians(degrees);
+            real c = cos(theta), s = sin(theta), t = 1 - c;
+            real x = a.x(), y = a.y(), z = a.z();
+            return affine(vec3(t*x*x + c,   t*x*y - s*z, t*x*z + s*y),
+                          vec3(t*x*y + s*z, t*y*y + c,   t*y*z - s*x),
+                          vec3(t*x*z - s*y, t*y*z + s*x, t*z*z + c),
+                          vec3(0,0,0));
+        }
+
+        point3 apply_point(const point3& p) const { return apply_vector(p) + offset; }
+        vec3 apply_vector(const vec3& v) const { return vec3(dot(row[0], v), dot(row[1], v), dot(row[2], v)); }
+
+        // Transpose of M times v. Of the inverse transform, this takes normals
+        // to the space of this one.
+        vec3 apply_transposed(const vec3& v) const { return v.x()*row[0] + v.y()*row[1] + v.z()*row[2]; }
+
+        // Box around the transformed corners of b
+        aabb apply(const aabb& b) const {
+            aabb box;
+            for (int corner = 0; corner < 8; corner++) {
+                point3 p((corner & 1 ? b.max() : b.min()).x(),
+                         (corner & 2 ? b.max() : b.min()).y(),
+                         (corner & 4 ? b.max() : b.min()).z());
+                box = surrounding_box(box, apply_point(p));
+            }
+            return box;
+        }
+
+        // This transform applied after t
+        affine operator*(const affine& t) const {
+            // Columns of t's matrix
+            vec3 tc0(t.row[0].x(), t.row[1].x(), t.row[2].x());
+            vec3 tc1(t.row[0].y(), t.row[1].y(), t.row[2].y());
+            vec3 tc2(t.row[0].z(), t.row[1].z(), t.row[2].z());
+            return affine(vec3(dot(row[0], tc0), dot(row[0], tc1), dot(row[0], tc2)),
+                          vec3(dot(row[1], tc0), dot(row[1], tc1), dot(row[1], tc2)),
+                          vec3(dot(row[2], tc0), dot(row[2], tc1), dot(row[2], tc2)),
+                          apply_point(t.offset));
+        }
+
+        real determinant() const { return dot(row[0], cross(row[1], row[2])); }
+
+        // Undefined when the determinant is 0
+        affine inverse() const {
+            // The columns of the inverse are the cross products of the rows
+            real inv_det = 1 / determinant();
+            vec3 c0 = inv_det * cross(row[1], row[2]);
+            vec3 c1 = inv_det * cross(row[2], row[0]);
+            vec3 c2 = inv_det * cross(row[0], row[1]);
+            affine inv(vec3(c0.x(), c1.x(), c2.x()), vec3(c0.y(), c1.y(), c2.y()), vec3(c0.z(), c1.z(), c2.z()),
+                       vec3(0,0,0));
+            inv.offset = -inv.apply_vector(offset);
+            return inv;
+        }
+
+    public:
+        vec3 row[3];
+        vec3 offset;
+};
+
+#endif
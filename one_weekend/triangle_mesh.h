@@ -0,0 +1,156 @@
+#ifndef TRIANGLE_MESH_H
+#define TRIANGLE_MESH_H
+
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "flat_array.h"
+#include "hittable.h"
+#include "primitive_store.h"
+#include "ray_stats.h"
+
+#include <vector>
+
+// Indexed triangle mesh: a vertex buffer shared by all triangles, three
+// indices per triangle and one material for the whole mesh. The edges and
+// normal of every triangle are computed once, at construction, together
+// with the mesh's own BVH.
+class triangle_mesh : public hittable {
+    public:
+        triangle_mesh() {}
+        triangle_mesh(std::vector<point3> mesh_vertices, std::vector<int> mesh_indices, const material* m);
+
+        int size() const { return static_cast<int>(indices.size() / 3); }
+
+        virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec)
+            const override;
+
+        virtual bool bounding_box(aabb& output_box) const override;
+
+        virtual bool occluded(const ray& r, real t_min, real t_max) const override;
+
+        virtual int hit_packet(const ray_packet& r, real t_min, preal& t_max, hit_record* rec, int active)
+            const override;
+
+        // Calls f on every array, the tree included, in a fixed order
+        template <typename F>
+        void for_each_array(F&& f) {
+            f(vertices);
+            f(indices);
+            triangles.for_each_array(f);
+            f(tree.nodes);
+        }
+
+        // Whether there are three indices of a vertex per triangle and the
+        // tree covers the triangles, for a mesh read from a geometry cache
+        bool valid() const;
+
+    public:
+        flat_array<point3> vertices;
+        flat_array<int> indices;        // Reordered along with triangles
+        const material* mat_ptr = nullptr;
+        triangle_soa triangles;
+        bvh_tree tree;
+};
+
+triangle_mesh::triangle_mesh(std::vector<point3> mesh_vertices, std::vector<int> mesh_indices, const material* m)
+    : mat_ptr(m)
+{
+    vertices.assign(std::move(mesh_vertices));
+    indices.assign(std::move(mesh_indices));
+
+    std::vector<aabb> boxes(size());
+    for (int i = 0; i < size(); i++) {
+        triangles.add(vertices[indices[3*i]], vertices[indices[3*i+1]], vertices[indices[3*i+2]]);
+        boxes[i] = triangles.bounding_box(i);
+    }
+
+    std::vector<int> order = tree.build(boxes, 2 * packet_width);
+    triangles.reorder(order);
+
+    std::vector<int> sorted_indices;
+    sorted_indices.reserve(indices.size());
+    for (int i : order)
+        sorted_indices.insert(sorted_indices.end(), &indices[3*i], &indices[3*i] + 3);
+    indices.assign(std::move(sorted_indices));
+}
+
+bool triangle_mesh::valid() const {
+    if (!triangles.valid() || indices.size() != 3 * size_t(triangles.size()))
+        return false;
+    for (size_t k = 0; k < indices.size(); k++)
+        if (indices[k] < 0 || size_t(indices[k]) >= vertices.size())
+            return false;
+    return tree.valid(triangles.size());
+}
+
+bool triangle_mesh::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+    real closest_so_far = t_max;
+    int nearest = -1;
+
+    ray_stats& stats = thread_ray_stats;
+    tree.traverse(r, t_min, t_max, [&](int first, int count, real& closest) {
+        int i = triangles.hit_range(r, first, count, t_min, closest);
+        stats.test(primitive_kind::triangle, count, i >= 0);
+        if (i < 0)
+            return false;
+        nearest = i;
+        closest_so_far = closest;
+        return true;
+    });
+
+    if (nearest < 0)
+        return false;
+
+    triangles.fill_record(nearest, r, closest_so_far, rec);
+    rec.mat_ptr = mat_ptr;
+    rec.light = -1;
+    return true;
+}
+
+bool triangle_mesh::occluded(const ray& r, real t_min, real t_max) const {
+    ray_stats& stats = thread_ray_stats;
+    return tree.traverse_any(r, t_min, t_max, [&](int first, int count) {
+        real closest = t_max;
+        int i = triangles.hit_range(r, first, count, t_min, closest);
+        stats.test(primitive_kind::triangle, count, i >= 0);
+        return i >= 0;
+    });
+}
+
+int triangle_mesh::hit_packet(const ray_packet& r, real t_min, preal& t_max, hit_record* rec, int active) const {
+    int nearest[packet_width];
+    ray_stats& stats = thread_ray_stats;
+
+    int hits = tree.traverse_packet(r, t_min, t_max, active, [&](int first, int count, int mask) {
+        int leaf_hits = 0;
+        for (int i = first; i < first + count; i++) {
+            int lanes = triangles.hit_packet(i, r, t_min, t_max, mask);
+            for (int k = 0; k < packet_width; k++)
+                if ((lanes >> k) & 1)
+                    nearest[k] = i;
+            leaf_hits |= lanes;
+            stats.test(primitive_kind::triangle, __builtin_popcount(mask), __builtin_popcount(lanes));
+        }
+        return leaf_hits;
+    });
+
+    alignas(32) real t[packet_width];
+    t_max.store(t);
+    for (int k = 0; k < packet_width; k++) {
+        if ((hits >> k) & 1) {
+            triangles.fill_record(nearest[k], r.rays[k], t[k], rec[k]);
+            rec[k].mat_ptr = mat_ptr;
+            rec[k].light = -1;
+        }
+    }
+
+    return hits;
+}
+
+bool triangle_mesh::bounding_box(aabb& output_box) const {
+    output_box = tree.bounding_box();
+    return !tree.nodes.empty();
+}
+
+#endif
@@ -1,143 +1,378 @@
+// See https://github.com/pelletier/vector3
+
 #ifndef VEC3_H
 #define VEC3_H
 
+#pragma once
+
+#include <smmintrin.h>
+#include <immintrin.h>
+#include <cstdlib>
+#if __APPLE__
+# include <stdlib.h>
+#else
+# include <malloc.h>
+#endif
+
 #include <cmath>
 #include <iostream>
 #include "rtweekend.h"
+#include "isa.h"
 
 using std::sqrt;
 
-class vec3 {
+// Useful constant
+static const __m128 SIGNMASK = _mm_castsi128_ps(_mm_set1_epi32(0x80000000));
+
+/**
+** 16-bytes aligned memory allocation function.
+** \param size Size of the memory chunk to allocate in bytes.
+** \return A pointer to the newly aligned memory, or nullptr.
+*/
+void* malloc_simd(const size_t size);
+
+/**
+** 16-bytes aligned memory free function.
+** \param v Memory pointer to free, which must have been allocated using
+** malloc_simd.
+*/
+void free_simd(void* v);
+
+/**
+** Math backends. A backend holds the components of a vector in its storage
+** type and implements the arithmetic on them as static functions, which
+** basic_vec3 forwards to. Everything is inline, so a vec3 compiles to the
+** backend's own code.
+*/
+
+/**
+** Scalar backend: three components of type T, one operation each. The
+** compiler is free to vectorize it.
+*/
+template <typename T>
+struct scalar_backend {
+    typedef T scalar;
+    struct storage { T e[3]; };
+
+    static const char* name() { return sizeof(T) == sizeof(double) ? "double" : "float"; }
+
+    static inline storage make(T x, T y, T z) { return {{x, y, z}}; }
+    static inline storage zero() { return {{0, 0, 0}}; }
+    static inline T get(const storage& v, int i) { return v.e[i]; }
+
+    static inline storage add(const storage& u, const storage& v) {
+        return {{u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]}};
+    }
+    static inline storage sub(const storage& u, const storage& v) {
+        return {{u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]}};
+    }
+    static inline storage mul(const storage& u, const storage& v) {
+        return {{u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]}};
+    }
+    static inline storage scale(T t, const storage& v) {
+        return {{t * v.e[0], t * v.e[1], t * v.e[2]}};
+    }
+    static inline storage neg(const storage& v) { return {{-v.e[0], -v.e[1], -v.e[2]}}; }
+
+    // t*v + c
+    static inline storage mul_add(T t, const storage& v, const storage& c) {
+        return {{t * v.e[0] + c.e[0], t * v.e[1] + c.e[1], t * v.e[2] + c.e[2]}};
+    }
+
+    static inline T dot(const storage& u, const storage& v) {
+        return u.e[0] * v.e[0] + u.e[1] * v.e[1] + u.e[2] * v.e[2];
+    }
+    static inline storage cross(const storage& u, const storage& v) {
+        return {{u.e[1] * v.e[2] - u.e[2] * v.e[1],
+                 u.e[2] * v.e[0] - u.e[0] * v.e[2],
+                 u.e[0] * v.e[1] - u.e[1] * v.e[0]}};
+    }
+    static inline storage normalize(const storage& v) { return scale(1 / std::sqrt(dot(v, v)), v); }
+
+    static inline storage min(const storage& u, const storage& v) {
+        return {{u.e[0] < v.e[0] ? u.e[0] : v.e[0], u.e[1] < v.e[1] ? u.e[1] : v.e[1], u.e[2] < v.e[2] ? u.e[2] : v.e[2]}};
+    }
+    static inline storage max(const storage& u, const storage& v) {
+        return {{u.e[0] > v.e[0] ? u.e[0] : v.e[0], u.e[1] > v.e[1] ? u.e[1] : v.e[1], u.e[2] > v.e[2] ? u.e[2] : v.e[2]}};
+    }
+    static inline T min_component(const storage& v) {
+        T m = v.e[0] < v.e[1] ? v.e[0] : v.e[1];
+        return m < v.e[2] ? m : v.e[2];
+    }
+    static inline T max_component(const storage& v) {
+        T m = v.e[0] > v.e[1] ? v.e[0] : v.e[1];
+        return m > v.e[2] ? m : v.e[2];
+    }
+};
+
+/**
+** SSE4.1 backend: float components in the low three lanes of an __m128,
+** the fourth lane kept at zero. Normalization uses the approximate
+** reciprocal square root, and the FMA builds fuse the multiply-adds.
+*/
+struct sse_backend {
+    typedef float scalar;
+    typedef __m128 storage;
+
+    static const char* name() { return "sse"; }
+
+    static inline storage make(float x, float y, float z) { return _mm_set_ps(0, z, y, x); }
+    static inline storage zero() { return _mm_setzero_ps(); }
+    static inline float get(storage v, int i) {
+        switch (i) {
+            case 0: return _mm_cvtss_f32(v);
+            case 1: return _mm_cvtss_f32(_mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1)));
+            case 2: return _mm_cvtss_f32(_mm_movehl_ps(v, v));
+            default: return std::numeric_limits<float>::quiet_NaN();
+        }
+    }
+
+    static inline storage add(storage u, storage v) { return _mm_add_ps(u, v); }
+    static inline storage sub(storage u, storage v) { return _mm_sub_ps(u, v); }
+    static inline storage mul(storage u, storage v) { return _mm_mul_ps(u, v); }
+    static inline storage scale(float t, storage v) { return _mm_mul_ps(v, _mm_set1_ps(t)); }
+    static inline storage neg(storage v) { return _mm_xor_ps(v, SIGNMASK); }
+
+    // t*v + c
+    static inline storage mul_add(float t, storage v, storage c) {
+#ifdef SIMD_FMA
+        return _mm_fmadd_ps(_mm_set1_ps(t), v, c);
+#else
+        return _mm_add_ps(c, _mm_mul_ps(_mm_set1_ps(t), v));
+#endif
+    }
+
+    static inline float dot(storage u, storage v) {
+#ifdef SIMD_FMA
+        // x*x', then y*y' and z*z' added in with fused multiply-adds
+        __m128 s = _mm_mul_ss(u, v);
+        s = _mm_fmadd_ss(_mm_shuffle_ps(u, u, _MM_SHUFFLE(3, 0, 2, 1)),
+                         _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 0, 2, 1)), s);
+        s = _mm_fmadd_ss(_mm_shuffle_ps(u, u, _MM_SHUFFLE(3, 1, 0, 2)),
+                         _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 1, 0, 2)), s);
+        return _mm_cvtss_f32(s);
+#else
+        return _mm_cvtss_f32(_mm_dp_ps(u, v, 0x71));
+#endif
+    }
+
+    static inline storage cross(storage u, storage v) {
+#ifdef SIMD_FMA
+        return _mm_fmsub_ps(
+                    _mm_shuffle_ps(u, u, _MM_SHUFFLE(3, 0, 2, 1)), _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 1, 0, 2)),
+                    _mm_mul_ps(_mm_shuffle_ps(u, u, _MM_SHUFFLE(3, 1, 0, 2)), _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 0, 2, 1)))
+                );
+#else
+        return _mm_sub_ps(
+                    _mm_mul_ps(_mm_shuffle_ps(u, u, _MM_SHUFFLE(3, 0, 2, 1)), _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 1, 0, 2))),
+                    _mm_mul_ps(_mm_shuffle_ps(u, u, _MM_SHUFFLE(3, 1, 0, 2)), _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 0, 2, 1)))
+                );
+#endif
+    }
+
+    static inline storage normalize(storage v) {
+        return _mm_mul_ps(v, _mm_rsqrt_ps(_mm_dp_ps(v, v, 0xFF)));
+    }
+
+    static inline storage min(storage u, storage v) { return _mm_min_ps(u, v); }
+    static inline storage max(storage u, storage v) { return _mm_max_ps(u, v); }
+
+    // Over the three components, leaving out the padding lane
+    static inline float min_component(storage v) {
+        __m128 m = _mm_min_ss(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1)));
+        return _mm_cvtss_f32(_mm_min_ss(m, _mm_movehl_ps(v, v)));
+    }
+    static inline float max_component(storage v) {
+        __m128 m = _mm_max_ss(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1)));
+        return _mm_cvtss_f32(_mm_max_ss(m, _mm_movehl_ps(v, v)));
+    }
+};
+
+/**
+** 3D mathematical vector over a math backend.
+*/
+template <typename Backend>
+class basic_vec3 {
     public:
-        vec3() : e{0,0,0} {}
-        vec3(double e0, double e1, double e2) : e{e0, e1, e2} {}
+        typedef Backend backend;
+        typedef typename Backend::scalar scalar;
+        typedef typename Backend::storage storage;
 
-        double x() const { return e[0]; }
-        double y() const { return e[1]; }
-        double z() const { return e[2]; }
+        inline basic_vec3() : v(Backend::zero()) {}
+        inline basic_vec3(scalar e0, scalar e1, scalar e2) : v(Backend::make(e0, e1, e2)) {}
+        inline basic_vec3(const storage& s) : v(s) {}
 
-        vec3 operator-() const { return vec3(-e[0], -e[1], -e[2]); }
-        double operator[](int i) const { return e[i]; }
-        double& operator[](int i) { return e[i]; }
+        inline void* operator new[](size_t x) { return malloc_simd(x); }
+        inline void operator delete[](void* x) { if (x) free_simd(x); }
 
-        vec3& operator+=(const vec3 &v) {
-            e[0] += v.e[0];
-            e[1] += v.e[1];
-            e[2] += v.e[2];
+        inline scalar x() const { return Backend::get(v, 0); }
+        inline scalar y() const { return Backend::get(v, 1); }
+        inline scalar z() const { return Backend::get(v, 2); }
+
+        inline basic_vec3 operator-() const { return Backend::neg(v); }
+        inline scalar operator[](int i) const { return Backend::get(v, i); }
+
+        inline basic_vec3& operator+=(const basic_vec3 &u) {
+            v = Backend::add(v, u.v);
             return *this;
         }
-
-        vec3& operator*=(const double t) {
-            e[0] *= t;
-            e[1] *= t;
-            e[2] *= t;
+        inline basic_vec3& operator*=(const scalar t) {
+            v = Backend::scale(t, v);
             return *this;
         }
-
-        vec3& operator/=(const double t) {
+        inline basic_vec3& operator/=(const scalar t) {
             return *this *= 1/t;
         }
 
-        double length() const {
-            return sqrt(length_squared());
+        inline scalar length() const {
+            return std::sqrt(length_squared());
         }
-
-        double length_squared() const {
-            return e[0]*e[0] + e[1]*e[1] + e[2]*e[2];
+        inline scalar length_squared() const {
+            return Backend::dot(v, v);
         }
 
         bool near_zero() const {
-            const double s = 1e-8;
-            return (fabs(e[0]) < s) && (fabs(e[1]) < s) && (fabs(e[2]) < s);
+            const scalar s = 1e-6;
+            return (fabs(x()) < s) && (fabs(y()) < s) && (fabs(z()) < s);
         }
 
-        inline static vec3 random() {
-            return vec3(random_double(), random_double(), random_double());
+        inline static basic_vec3 random(pcg32& rng) {
+            scalar x = random_real(rng);
+            scalar y = random_real(rng);
+            return basic_vec3(x, y, random_real(rng));
         }
 
-        inline static vec3 random(double min, double max) {
-            return vec3(random_double(min,max), random_double(min,max), random_double(min,max));
+        inline static basic_vec3 random(scalar min, scalar max, pcg32& rng) {
+            scalar x = random_real(min,max,rng);
+            scalar y = random_real(min,max,rng);
+            return basic_vec3(x, y, random_real(min,max,rng));
         }
 
     public:
-        double e[3];
+        storage v;
 };
 
+#if defined(MATH_BACKEND_DOUBLE)
+typedef scalar_backend<double> math_backend;
+#elif defined(MATH_BACKEND_FLOAT)
+typedef scalar_backend<float> math_backend;
+#else
+typedef sse_backend math_backend;
+#endif
+
+typedef basic_vec3<math_backend> vec3;
+
 // Type aliases for vec3
 using point3 = vec3;   // 3D point
 using color = vec3;    // RGB color
 
 // vec3 Utility Functions
-inline std::ostream& operator<<(std::ostream &out, const vec3 &v) {
-    return out << v.e[0] << ' ' << v.e[1] << ' ' << v.e[2];
+template <typename B>
+inline std::ostream& operator<<(std::ostream &out, const basic_vec3<B> &v) {
+    return out << v.x() << ' ' << v.y() << ' ' << v.z();
 }
 
-inline vec3 operator+(const vec3 &u, const vec3 &v) {
-    return vec3(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
+template <typename B>
+inline basic_vec3<B> operator+(const basic_vec3<B> &u, const basic_vec3<B> &v) {
+    return B::add(u.v, v.v);
 }
 
-inline vec3 operator-(const vec3 &u, const vec3 &v) {
-    return vec3(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
+template <typename B>
+inline basic_vec3<B> operator-(const basic_vec3<B> &u, const basic_vec3<B> &v) {
+    return B::sub(u.v, v.v);
 }
 
-inline vec3 operator*(const vec3 &u, const vec3 &v) {
-    return vec3(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
+template <typename B>
+inline basic_vec3<B> operator*(const basic_vec3<B> &u, const basic_vec3<B> &v) {
+    return B::mul(u.v, v.v);
 }
 
-inline vec3 operator*(double t, const vec3 &v) {
-    return vec3(t*v.e[0], t*v.e[1], t*v.e[2]);
+template <typename B>
+inline basic_vec3<B> operator*(typename B::scalar t, const basic_vec3<B> &v) {
+    return B::scale(t, v.v);
 }
 
-inline vec3 operator*(const vec3 &v, double t) {
+template <typename B>
+inline basic_vec3<B> operator*(const basic_vec3<B> &v, typename B::scalar t) {
     return t * v;
 }
 
-inline vec3 operator/(vec3 v, double t) {
+template <typename B>
+inline basic_vec3<B> operator/(const basic_vec3<B> &v, typename B::scalar t) {
     return (1/t) * v;
 }
 
-inline double dot(const vec3 &u, const vec3 &v) {
-    return u.e[0] * v.e[0]
-         + u.e[1] * v.e[1]
-         + u.e[2] * v.e[2];
+// t*v + c, fused where the backend can
+template <typename B>
+inline basic_vec3<B> mul_add(typename B::scalar t, const basic_vec3<B> &v, const basic_vec3<B> &c) {
+    return B::mul_add(t, v.v, c.v);
 }
 
-inline vec3 cross(const vec3 &u, const vec3 &v) {
-    return vec3(u.e[1] * v.e[2] - u.e[2] * v.e[1],
-                u.e[2] * v.e[0] - u.e[0] * v.e[2],
-                u.e[0] * v.e[1] - u.e[1] * v.e[0]);
+template <typename B>
+inline typename B::scalar dot(const basic_vec3<B> &u, const basic_vec3<B> &v) {
+    return B::dot(u.v, v.v);
 }
 
-inline double det(const vec3 &a, const vec3 &b, const vec3 &c) {
+template <typename B>
+inline basic_vec3<B> cross(const basic_vec3<B> &u, const basic_vec3<B> &v) {
+    return B::cross(u.v, v.v);
+}
+
+template <typename B>
+inline typename B::scalar det(const basic_vec3<B> &a, const basic_vec3<B> &b, const basic_vec3<B> &c) {
     return dot(a,cross(b,c));
 }
 
-inline vec3 unit_vector(vec3 v) {
-    return v / v.length();
+// Exact with the scalar backends, about 12 bits with SSE
+template <typename B>
+inline basic_vec3<B> unit_vector(const basic_vec3<B> &v) {
+    return B::normalize(v.v);
+}
+
+// Component-wise minimum and maximum
+template <typename B>
+inline basic_vec3<B> vmin(const basic_vec3<B> &u, const basic_vec3<B> &v) {
+    return B::min(u.v, v.v);
+}
+
+template <typename B>
+inline basic_vec3<B> vmax(const basic_vec3<B> &u, const basic_vec3<B> &v) {
+    return B::max(u.v, v.v);
+}
+
+template <typename B>
+inline typename B::scalar min_component(const basic_vec3<B> &v) {
+    return B::min_component(v.v);
+}
+
+template <typename B>
+inline typename B::scalar max_component(const basic_vec3<B> &v) {
+    return B::max_component(v.v);
 }
 
-vec3 random_in_unit_sphere() {
+vec3 random_in_unit_sphere(pcg32& rng) {
     while(true) {
-        vec3 p = vec3::random(-1,1);
+        vec3 p = vec3::random(-1,1,rng);
         if (p.length_squared() >= 1) continue;
         return p;
     }
 }
 
-vec3 random_in_unit_disk() {
+vec3 random_in_unit_disk(pcg32& rng) {
     while (true) {
-        auto p = vec3(random_double(-1,1), random_double(-1,1), 0);
+        real x = random_real(-1,1,rng);
+        auto p = vec3(x, random_real(-1,1,rng), 0);
         if (p.length_squared() >= 1) continue;
         return p;
     }
 }
 
-vec3 random_unit_vector() {
-    return unit_vector(random_in_unit_sphere());
+vec3 random_unit_vector(pcg32& rng) {
+    return unit_vector(random_in_unit_sphere(rng));
 }
 
-vec3 random_in_hemisphere(const vec3& normal) {
-    vec3 in_unit_sphere = random_in_unit_sphere();
+vec3 random_in_hemisphere(const vec3& normal, pcg32& rng) {
+    vec3 in_unit_sphere = random_in_unit_sphere(rng);
     if (dot(in_unit_sphere, normal) > 0.0) // Same emisphere as normal
         return in_unit_sphere;
     else
@@ -145,14 +380,33 @@ vec3 random_in_hemisphere(const vec3& normal) {
 }
 
 vec3 reflect(const vec3& v, const vec3& n) {
-    return v - 2 * dot(v,n) * n;
+    return v - 2.0 * dot(v,n) * n;
+}
+
+vec3 refract(const vec3& uv, const vec3& n, real etai_over_etat) {
+    real cos_theta = fmin(dot(-uv,n), 1.0);
+    vec3 r_out_perp = etai_over_etat * mul_add(cos_theta, n, uv);
+    return mul_add(-sqrt(fabs(1.0 - r_out_perp.length_squared())), n, r_out_perp);
+}
+
+void* malloc_simd(const size_t size) {
+#if defined WIN32
+    return _aligned_malloc(size, 16);
+#elif defined __linux__
+    return memalign(16, size);
+#elif defined __MACH__
+    return malloc(size);
+#else // use page-aligned memory for other systems
+    return valloc(size);
+#endif
 }
 
-vec3 refract(const vec3& uv, const vec3& n, double etai_over_etat) {
-    double cos_theta = fmin(dot(-uv,n), 1.0);
-    vec3 r_out_perp = etai_over_etat * (uv + cos_theta*n);
-    vec3 r_out_parallel = -sqrt(fabs(1.0 - r_out_perp.length_squared())) * n;
-    return r_out_perp + r_out_parallel;
+void free_simd(void* v) {
+#if defined WIN32
+    return _aligned_free(v);
+#else
+    return free(v);
+#endif
 }
 
-#endif
\ No newline at end of file
+#endif
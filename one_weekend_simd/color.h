@@ -1,25 +0,0 @@
-#ifndef COLOR_H
-#define COLOR_H
-
-#include "vec3.h"
-
-#include <iostream>
-
-void write_color(std::ostream &out, color pixel_color, unsigned int samples_per_pixel) {
-    float r = pixel_color.x();
-    float g = pixel_color.y();
-    float b = pixel_color.z();
-
-    // Divide the color by the number of samples
-    float scale = 1.0 / samples_per_pixel;
-    r = sqrt(r * scale);
-    g = sqrt(g * scale);
-    b = sqrt(b * scale);
-
-    // Write the translated [0,255] value of each color component.
-    out << static_cast<int>(256 * clamp(r, 0.0, 0.999)) << ' '
-        << static_cast<int>(256 * clamp(g, 0.0, 0.999)) << ' '
-        << static_cast<int>(256 * clamp(b, 0.0, 0.999)) << '\n';
-}
-
-#endif
\ No newline at end of file